@@ -0,0 +1,148 @@
+#include "arena.h"
+
+#include <string.h>
+
+struct ArenaChunk {
+	ArenaChunk *next;
+	size_t size; // bytes of data
+	size_t used;
+};
+
+// chunks' data starts this far in, so it's cache line aligned
+#define ARENA_CHUNK_HEADER ((size_t)CACHE_LINE_SIZE)
+// the smallest chunk to allocate: 2 MiB with the header, so small chunks can be a huge page
+#define ARENA_MIN_CHUNK_SIZE (HUGE_PAGE_SIZE - ARENA_CHUNK_HEADER)
+
+static_assert(sizeof(ArenaChunk) <= ARENA_CHUNK_HEADER, "Arena chunk header is too big");
+
+static unsigned char *arena_chunk_data(ArenaChunk *chunk) {
+	return (unsigned char *)chunk + ARENA_CHUNK_HEADER;
+}
+
+static size_t arena_round_up(size_t bytes) {
+	return (bytes + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+}
+
+// count bytes going from old_bytes to new_bytes for tag
+static void arena_track(Arena *arena, MemoryTag tag, size_t old_bytes, size_t new_bytes) {
+	if (old_bytes == new_bytes) return;
+	arena->live[tag] += new_bytes - old_bytes;
+	memory_track(tag, old_bytes, new_bytes);
+}
+
+// move on to a chunk with at least size bytes free
+static ArenaChunk *arena_next_chunk(Arena *arena, size_t size) {
+	ArenaChunk *prev = arena->chunk;
+	ArenaChunk *next = prev ? prev->next : arena->first;
+	if (!next || next->size < size) {
+		// the kept chunk is too small (or there isn't one), so put a new one before it
+		size_t chunk_size = size > ARENA_MIN_CHUNK_SIZE ? size : ARENA_MIN_CHUNK_SIZE;
+		ArenaChunk *chunk = memory_alloc_aligned(ARENA_CHUNK_HEADER + chunk_size, CACHE_LINE_SIZE,
+			MEMORY_HUGE_PAGES, MEMORY_ARENA);
+		chunk->next = next;
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		if (prev)
+			prev->next = chunk;
+		else
+			arena->first = chunk;
+		next = chunk;
+	}
+	assert(next->used == 0);
+	arena->chunk = next;
+	// the last allocation was in the old chunk, so it can't be resized in place any more
+	arena->last = NULL;
+	return next;
+}
+
+// bytes of uninitialized, untracked memory
+static void *arena_bump(Arena *arena, size_t bytes) {
+	size_t size = arena_round_up(bytes);
+	ArenaChunk *chunk = arena->chunk;
+	if (!chunk || chunk->size - chunk->used < size)
+		chunk = arena_next_chunk(arena, size);
+	void *mem = arena_chunk_data(chunk) + chunk->used;
+	chunk->used += size;
+	arena->last = mem;
+	return mem;
+}
+
+void arena_init(Arena *arena) {
+	memset(arena, 0, sizeof *arena);
+}
+
+void arena_reserve(Arena *arena, size_t bytes) {
+	size_t size = arena_round_up(bytes);
+	ArenaChunk *chunk = arena->chunk;
+	if (!chunk || chunk->size - chunk->used < size)
+		arena_next_chunk(arena, size);
+}
+
+void *arena_alloc(Arena *arena, size_t bytes, unsigned flags, MemoryTag tag) {
+	if (bytes == 0) return NULL;
+	assert(tag < MEMORY_N_TAGS);
+	void *mem = arena_bump(arena, bytes);
+	arena_track(arena, tag, 0, bytes);
+	if (flags & MEMORY_ZERO)
+		memset(mem, 0, bytes);
+	return mem;
+}
+
+void *arena_realloc(Arena *arena, void *mem, size_t old_bytes, size_t new_bytes, MemoryTag tag) {
+	if (!mem)
+		return arena_alloc(arena, new_bytes, 0, tag);
+	assert(tag < MEMORY_N_TAGS);
+	ArenaChunk *chunk = arena->chunk;
+	if (mem == arena->last) {
+		size_t start = (size_t)((unsigned char *)mem - arena_chunk_data(chunk));
+		size_t size = arena_round_up(new_bytes);
+		if (size <= chunk->size - start) {
+			chunk->used = start + size;
+			arena_track(arena, tag, old_bytes, new_bytes);
+			return mem;
+		}
+	}
+	void *new_mem = arena_bump(arena, new_bytes);
+	memcpy(new_mem, mem, old_bytes < new_bytes ? old_bytes : new_bytes);
+	arena_track(arena, tag, old_bytes, new_bytes);
+	return new_mem;
+}
+
+ArenaMark arena_mark(Arena const *arena) {
+	ArenaMark mark;
+	mark.chunk = arena->chunk;
+	mark.used = arena->chunk ? arena->chunk->used : 0;
+	memcpy(mark.live, arena->live, sizeof mark.live);
+	return mark;
+}
+
+void arena_rewind(Arena *arena, ArenaMark const *mark) {
+	// empty every chunk that's been filled since the mark
+	ArenaChunk *chunk = mark->chunk ? mark->chunk->next : arena->first;
+	ArenaChunk *end = arena->chunk ? arena->chunk->next : NULL;
+	for (; chunk != end; chunk = chunk->next)
+		chunk->used = 0;
+	if (mark->chunk) {
+		mark->chunk->used = mark->used;
+		arena->chunk = mark->chunk;
+	} else {
+		arena->chunk = NULL;
+	}
+	arena->last = NULL;
+	for (int tag = 0; tag < MEMORY_N_TAGS; ++tag)
+		arena_track(arena, (MemoryTag)tag, arena->live[tag], mark->live[tag]);
+}
+
+void arena_reset(Arena *arena) {
+	ArenaMark start = {0};
+	arena_rewind(arena, &start);
+}
+
+void arena_free(Arena *arena) {
+	arena_reset(arena);
+	for (ArenaChunk *chunk = arena->first, *next; chunk; chunk = next) {
+		next = chunk->next;
+		memory_free(chunk);
+	}
+	memset(arena, 0, sizeof *arena);
+}
@@ -0,0 +1,49 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include "core.h"
+
+// memory which is handed out by bumping a pointer and freed all at once.
+// it comes from a list of chunks, which are kept when the arena is reset or
+// rewound, so filling it up again doesn't allocate.
+// every allocation is cache line aligned, so arrays written by different threads
+// don't share cache lines.
+
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct {
+	ArenaChunk *first; // every chunk, in the order they're filled
+	ArenaChunk *chunk; // the one being filled (the ones after it are empty)
+	void *last; // the most recent allocation, which can be resized in place
+	size_t live[MEMORY_N_TAGS]; // bytes handed out for each tag
+} Arena;
+
+// how full an arena was, to go back to later
+typedef struct {
+	ArenaChunk *chunk;
+	size_t used;
+	size_t live[MEMORY_N_TAGS];
+} ArenaMark;
+
+extern void arena_init(Arena *arena);
+// make sure the next bytes bytes of allocations fit into one chunk
+extern void arena_reserve(Arena *arena, size_t bytes);
+// allocate memory with the given MEMORY_ flags (MEMORY_HUGE_PAGES is up to the chunks); die on failure
+extern void *arena_alloc(Arena *arena, size_t bytes, unsigned flags, MemoryTag tag);
+// resize mem (which is old_bytes long, and may be NULL), keeping its contents.
+// this is done in place if mem was the last allocation and there's room after it;
+// otherwise mem is copied, and its space isn't reused until the arena is rewound past it.
+extern void *arena_realloc(Arena *arena, void *mem, size_t old_bytes, size_t new_bytes, MemoryTag tag);
+extern ArenaMark arena_mark(Arena const *arena);
+// free everything allocated since mark was taken
+extern void arena_rewind(Arena *arena, ArenaMark const *mark);
+// free everything allocated from the arena
+extern void arena_reset(Arena *arena);
+// free the arena's chunks too
+extern void arena_free(Arena *arena);
+
+#define arena_allocate(arena, type, n, flags, tag) ((type *)arena_alloc((arena), (n) * sizeof(type), (flags), (tag)))
+#define arena_reallocate(arena, memory, old_n, new_n, tag) \
+	((memory) = arena_realloc((arena), (memory), sizeof *(memory) * (old_n), sizeof *(memory) * (new_n), (tag)))
+
+#endif // ARENA_H_
@@ -1,9 +1,11 @@
-varying vec2 offset;
-varying vec3 color;
+in vec2 offset;
+in vec3 color;
+
+out vec4 frag_color;
 
 void main() {
 	float dist = dot(offset, offset);
 	dist *= dist;
 	float alpha = 1.0 - dist;
-	gl_FragColor = vec4(color, alpha);
+	frag_color = vec4(color, alpha);
 }
@@ -1,14 +1,16 @@
-attribute vec2 v_pos;
-attribute vec2 v_offset;
-attribute int v_valence;
+in vec2 v_offset;
+in int v_valence;
 
+uniform samplerBuffer u_atom_x, u_atom_y; // atom positions, in cells
+uniform vec2 u_cell_size; // size of a cell on screen
 uniform vec2 u_atom_radius;
 
-varying vec2 offset;
-varying vec3 color;
+out vec2 offset;
+out vec3 color;
 
 void main() {
-	gl_Position = vec4(v_pos + v_offset * u_atom_radius, 0.0, 1.0);
+	vec2 pos = vec2(texelFetch(u_atom_x, gl_InstanceID).x, texelFetch(u_atom_y, gl_InstanceID).x) * u_cell_size - 1.0;
+	gl_Position = vec4(pos + v_offset * u_atom_radius, 0.0, 1.0);
 	offset = v_offset;
 	switch (v_valence) {
 	case 1:
@@ -1,3 +1,5 @@
+out vec4 frag_color;
+
 void main() {
-	gl_FragColor = vec4(1.0);
+	frag_color = vec4(1.0);
 }
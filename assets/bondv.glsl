@@ -1,5 +1,26 @@
-attribute vec2 v_pos;
+// each instance is a bond, drawn as a line from atom a to atom b
+in uint v_atom_a, v_atom_b;
+in uint v_number; // 0 for the first bond between a and b, 1 for the second, 2 for the third
+
+uniform samplerBuffer u_atom_x, u_atom_y; // atom positions, in cells
+uniform vec2 u_cell_size; // size of a cell on screen
+uniform float u_bond_sep; // distance between the lines of a double/triple bond
+
+vec2 atom_pos(uint atom) {
+	return vec2(texelFetch(u_atom_x, int(atom)).x, texelFetch(u_atom_y, int(atom)).x) * u_cell_size - 1.0;
+}
 
 void main() {
-	gl_Position = vec4(v_pos, 0.0, 1.0);
+	vec2 a = atom_pos(v_atom_a), b = atom_pos(v_atom_b);
+	vec2 d = a - b;
+	if (dot(d, d) > 0.5) {
+		// the bond wraps around the universe, and would stretch across the screen.
+		// put both ends outside the view so the line is clipped away.
+		gl_Position = vec4(2.0, 2.0, 0.0, 1.0);
+		return;
+	}
+	vec2 pos = gl_VertexID == 0 ? a : b;
+	if (v_number == 1u) pos.x -= u_bond_sep;
+	else if (v_number == 2u) pos.x += u_bond_sep;
+	gl_Position = vec4(pos, 0.0, 1.0);
 }
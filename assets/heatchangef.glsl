@@ -0,0 +1,7 @@
+in float heat;
+
+out vec4 frag_color;
+
+void main() {
+	frag_color = vec4(heat);
+}
@@ -0,0 +1,9 @@
+in vec2 v_pos;
+in float v_heat;
+
+out float heat;
+
+void main() {
+	gl_Position = vec4(v_pos, 0.0, 1.0);
+	heat = v_heat;
+}
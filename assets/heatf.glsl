@@ -1,11 +1,13 @@
-varying vec2 uv;
+in vec2 uv;
 
 uniform sampler2D u_heatmap;
 uniform vec3 u_color_cold, u_color_hot;
 uniform float u_heat_max;
 
+out vec4 frag_color;
+
 void main() {
-	float heat = texture2D(u_heatmap, uv).x;
-	gl_FragColor = vec4(mix(u_color_cold, u_color_hot, heat * (1.0 / u_heat_max)), 1.0);
+	float heat = texture(u_heatmap, uv).x;
+	frag_color = vec4(mix(u_color_cold, u_color_hot, heat * (1.0 / u_heat_max)), 1.0);
 }
 
@@ -1,7 +1,7 @@
 
-attribute vec2 v_pos;
+in vec2 v_pos;
 
-varying vec2 uv;
+out vec2 uv;
 
 void main() {
 	uv = v_pos * 0.5 + 0.5;
@@ -0,0 +1,376 @@
+// times each phase of a step on universes of various sizes, and prints the results
+// as a table and writes them as JSON, for comparing versions and machines
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "os.h"
+#include "perfcount.h"
+#include "snapshot.h"
+#include "universe.h"
+
+typedef enum {
+	PHASE_DIFFUSE,
+	PHASE_MOVE,
+	PHASE_REGRID,
+	PHASE_BOND,
+	PHASE_STEP, // all of the above
+	PHASE_PUBLISH, // copying what's needed for drawing (the CPU's part in making geometry)
+	N_PHASES
+} Phase;
+
+static char const *const phase_names[N_PHASES] = {
+	[PHASE_DIFFUSE] = "diffuse",
+	[PHASE_MOVE] = "move",
+	[PHASE_REGRID] = "regrid",
+	[PHASE_BOND] = "bond",
+	[PHASE_STEP] = "step",
+	[PHASE_PUBLISH] = "publish",
+};
+
+typedef struct {
+	int width, height;
+} Grid;
+
+typedef struct {
+	AtomID n_atoms;
+	Grid grid;
+	unsigned long n_steps;
+	unsigned n_bonds; // at the end
+	bool memory_tracked;
+	size_t memory[MEMORY_N_TAGS + 1]; // bytes in use at the end, for each tag and in total
+	double seconds[N_PHASES]; // total over all steps
+	PerfCounts counts[N_PHASES]; // total over all steps, if counting
+	double bytes[N_PHASES]; // moved per step (estimated)
+} Result;
+
+// roughly how many bytes each phase reads and writes per step, counting each array once,
+// for working out effective bandwidth
+static void estimate_bytes(Result *r) {
+	double atoms = (double)r->n_atoms, cells = (double)r->grid.width * (double)r->grid.height;
+	r->bytes[PHASE_DIFFUSE] = cells * 2 * sizeof(float); // read one grid, write the other
+	r->bytes[PHASE_MOVE] = atoms * 6 * sizeof(float); // read x, y, vx, vy, write x, y
+	// read positions, write and read each atom's cell, write the sorted atoms; count and prefix-sum cells
+	r->bytes[PHASE_REGRID] = atoms * (2 * sizeof(float) + 2 * sizeof(unsigned) + sizeof(AtomID))
+		+ cells * 2 * sizeof(unsigned);
+	// each cell's range of atoms, heat and proposal (the few atoms checked per cell are left out)
+	r->bytes[PHASE_BOND] = cells * (2 * sizeof(unsigned) + sizeof(float) + sizeof(BondProposal));
+	r->bytes[PHASE_STEP] = r->bytes[PHASE_DIFFUSE] + r->bytes[PHASE_MOVE] + r->bytes[PHASE_REGRID] + r->bytes[PHASE_BOND];
+	// read and write positions and every row of heat (the new bonds are left out)
+	r->bytes[PHASE_PUBLISH] = atoms * 4 * sizeof(float) + cells * 2 * sizeof(float);
+}
+
+// which hardware performance counters are being read (none unless --perf is given)
+static unsigned counters;
+
+typedef struct {
+	Time time;
+	PerfCounts counts;
+} Sample;
+
+static void sample(Sample *s) {
+	if (counters)
+		perf_read(&s->counts);
+	else
+		memset(&s->counts, 0, sizeof s->counts);
+	s->time = time_now();
+}
+
+// add everything since *last to phase, and start the next phase
+static void end_phase(Result *r, Phase phase, Sample *last) {
+	Sample now;
+	sample(&now);
+	r->seconds[phase] += time_sub(now.time, last->time);
+	for (int c = 0; c < PERF_N_COUNTERS; ++c)
+		r->counts[phase].value[c] += now.counts.value[c] - last->counts.value[c];
+	*last = now;
+}
+
+// time stepping u, which has just been made or reset
+static void run(Result *r, Universe *u, float dt, unsigned long min_steps, double min_seconds) {
+	SnapshotBuffer *snapshots = snapshot_buffer_create(u);
+	// get past the first steps, where every atom is still unbonded and everything is cold in cache
+	for (int i = 0; i < 2; ++i) {
+		universe_step(u, dt);
+		snapshot_buffer_publish(snapshots, u);
+	}
+
+	memset(r->seconds, 0, sizeof r->seconds);
+	memset(r->counts, 0, sizeof r->counts);
+	r->n_atoms = u->n_atoms;
+	r->grid.width = u->width;
+	r->grid.height = u->height;
+	r->n_steps = 0;
+	double total = 0;
+	while (r->n_steps < min_steps || total < min_seconds) {
+		Sample t;
+		sample(&t);
+		universe_diffuse(u);
+		end_phase(r, PHASE_DIFFUSE, &t);
+		universe_move(u, dt);
+		end_phase(r, PHASE_MOVE, &t);
+		universe_regrid(u);
+		end_phase(r, PHASE_REGRID, &t);
+		universe_bond(u, dt);
+		end_phase(r, PHASE_BOND, &t);
+		++u->step;
+		snapshot_buffer_publish(snapshots, u);
+		end_phase(r, PHASE_PUBLISH, &t);
+		// the reader would normally take each snapshot, so the next one only has to copy what changed
+		snapshot_buffer_acquire(snapshots);
+		++r->n_steps;
+		total = r->seconds[PHASE_DIFFUSE] + r->seconds[PHASE_MOVE] + r->seconds[PHASE_REGRID]
+			+ r->seconds[PHASE_BOND] + r->seconds[PHASE_PUBLISH];
+	}
+	r->seconds[PHASE_STEP] = r->seconds[PHASE_DIFFUSE] + r->seconds[PHASE_MOVE]
+		+ r->seconds[PHASE_REGRID] + r->seconds[PHASE_BOND];
+	for (int c = 0; c < PERF_N_COUNTERS; ++c)
+		r->counts[PHASE_STEP].value[c] = r->counts[PHASE_DIFFUSE].value[c] + r->counts[PHASE_MOVE].value[c]
+			+ r->counts[PHASE_REGRID].value[c] + r->counts[PHASE_BOND].value[c];
+	r->n_bonds = u->n_bonds;
+	for (int tag = 0; tag <= MEMORY_N_TAGS; ++tag) {
+		MemoryStats stats;
+		r->memory_tracked = memory_stats((MemoryTag)tag, &stats);
+		r->memory[tag] = stats.live;
+	}
+	estimate_bytes(r);
+	snapshot_buffer_destroy(snapshots);
+}
+
+typedef struct {
+	double steps_per_second, ns_per_step, ns_per_atom, ns_per_cell, gb_per_second;
+	double ipc;
+	double per_step[PERF_N_COUNTERS], per_atom[PERF_N_COUNTERS], per_cell[PERF_N_COUNTERS];
+} PhaseStats;
+
+static bool counting(PerfCounter c) {
+	return counters & (1u << c);
+}
+
+static PhaseStats phase_stats(Result const *r, Phase phase) {
+	PhaseStats s = {0};
+	double seconds = r->seconds[phase] / (double)r->n_steps;
+	s.steps_per_second = seconds > 0 ? 1 / seconds : 0;
+	s.ns_per_step = seconds * 1e9;
+	s.ns_per_atom = s.ns_per_step / (double)r->n_atoms;
+	s.ns_per_cell = s.ns_per_step / ((double)r->grid.width * (double)r->grid.height);
+	s.gb_per_second = seconds > 0 ? r->bytes[phase] / seconds * 1e-9 : 0;
+	for (int c = 0; c < PERF_N_COUNTERS; ++c) {
+		s.per_step[c] = (double)r->counts[phase].value[c] / (double)r->n_steps;
+		s.per_atom[c] = s.per_step[c] / (double)r->n_atoms;
+		s.per_cell[c] = s.per_step[c] / ((double)r->grid.width * (double)r->grid.height);
+	}
+	if (r->counts[phase].value[PERF_CYCLES])
+		s.ipc = (double)r->counts[phase].value[PERF_INSTRUCTIONS] / (double)r->counts[phase].value[PERF_CYCLES];
+	return s;
+}
+
+// where the table goes (stderr if the JSON is going to stdout)
+static FILE *table_out;
+
+static void print_header(void) {
+	fprintf(table_out, "%10s %11s %-8s %6s %12s %12s %10s %10s %8s",
+		"atoms", "grid", "phase", "steps", "steps/s", "ms/step", "ns/atom", "ns/cell", "GB/s");
+	if (counting(PERF_CYCLES) && counting(PERF_INSTRUCTIONS))
+		fprintf(table_out, " %6s", "IPC");
+	if (counting(PERF_L1D_MISSES))
+		fprintf(table_out, " %10s %10s", "L1D/atom", "L1D/cell");
+	if (counting(PERF_LLC_MISSES))
+		fprintf(table_out, " %10s %10s", "LLC/atom", "LLC/cell");
+	if (counting(PERF_BRANCH_MISSES))
+		fprintf(table_out, " %10s", "brmiss/atom");
+	fprintf(table_out, "\n");
+}
+
+static void print_result(Result const *r) {
+	char grid[32];
+	snprintf(grid, sizeof grid, "%dx%d", r->grid.width, r->grid.height);
+	for (int p = 0; p < N_PHASES; ++p) {
+		PhaseStats s = phase_stats(r, (Phase)p);
+		fprintf(table_out, "%10u %11s %-8s %6lu %12.1f %12.3f %10.3f %10.3f %8.2f",
+			r->n_atoms, grid, phase_names[p], r->n_steps, s.steps_per_second,
+			s.ns_per_step * 1e-6, s.ns_per_atom, s.ns_per_cell, s.gb_per_second);
+		if (counting(PERF_CYCLES) && counting(PERF_INSTRUCTIONS))
+			fprintf(table_out, " %6.2f", s.ipc);
+		if (counting(PERF_L1D_MISSES))
+			fprintf(table_out, " %10.4f %10.4f", s.per_atom[PERF_L1D_MISSES], s.per_cell[PERF_L1D_MISSES]);
+		if (counting(PERF_LLC_MISSES))
+			fprintf(table_out, " %10.4f %10.4f", s.per_atom[PERF_LLC_MISSES], s.per_cell[PERF_LLC_MISSES]);
+		if (counting(PERF_BRANCH_MISSES))
+			fprintf(table_out, " %11.4f", s.per_atom[PERF_BRANCH_MISSES]);
+		fprintf(table_out, "\n");
+	}
+	fflush(table_out);
+}
+
+static bool write_json(char const *filename, Result const *results, unsigned n_results, unsigned n_threads) {
+	FILE *fp = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "w");
+	if (!fp) return false;
+	fprintf(fp, "{\n  \"threads\": %u,\n  \"results\": [\n", n_threads);
+	for (unsigned i = 0; i < n_results; ++i) {
+		Result const *r = &results[i];
+		fprintf(fp, "    {\"atoms\": %u, \"width\": %d, \"height\": %d, \"steps\": %lu, \"bonds\": %u, ",
+			r->n_atoms, r->grid.width, r->grid.height, r->n_steps, r->n_bonds);
+		if (r->memory_tracked) {
+			fprintf(fp, "\"memory_bytes\": {");
+			for (int tag = 0; tag <= MEMORY_N_TAGS; ++tag)
+				fprintf(fp, "%s\"%s\": %zu", tag ? ", " : "", memory_tag_name((MemoryTag)tag), r->memory[tag]);
+			fprintf(fp, "}, ");
+		}
+		fprintf(fp, "\"phases\": {");
+		for (int p = 0; p < N_PHASES; ++p) {
+			PhaseStats s = phase_stats(r, (Phase)p);
+			fprintf(fp, "%s\n      \"%s\": {\"steps_per_second\": %.6g, \"ns_per_step\": %.6g, \"ns_per_atom\": %.6g, "
+				"\"ns_per_cell\": %.6g, \"gb_per_second\": %.6g",
+				p ? "," : "", phase_names[p], s.steps_per_second, s.ns_per_step,
+				s.ns_per_atom, s.ns_per_cell, s.gb_per_second);
+			if (counters) {
+				// counts are per step
+				fprintf(fp, ", \"counters\": {");
+				char const *sep = "";
+				for (int c = 0; c < PERF_N_COUNTERS; ++c) {
+					if (!counting((PerfCounter)c)) continue;
+					char const *name = perf_counter_name((PerfCounter)c);
+					fprintf(fp, "%s\"%s\": %.6g, \"%s_per_atom\": %.6g, \"%s_per_cell\": %.6g",
+						sep, name, s.per_step[c], name, s.per_atom[c], name, s.per_cell[c]);
+					sep = ", ";
+				}
+				if (counting(PERF_CYCLES) && counting(PERF_INSTRUCTIONS))
+					fprintf(fp, "%s\"ipc\": %.6g", sep, s.ipc);
+				fprintf(fp, "}");
+			}
+			fprintf(fp, "}");
+		}
+		fprintf(fp, "\n    }}%s\n", i + 1 < n_results ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+	bool ok = !ferror(fp);
+	if (fp != stdout && fclose(fp) != 0) ok = false;
+	return ok;
+}
+
+// parse a comma-separated list of numbers. returns the number of them.
+static unsigned parse_atom_counts(char const *str, AtomID *counts, unsigned max_counts) {
+	unsigned n = 0;
+	while (*str && n < max_counts) {
+		char *end = NULL;
+		unsigned long count = strtoul(str, &end, 10);
+		if (end == str || count == 0)
+			die("Bad atom count: %s", str);
+		counts[n++] = (AtomID)count;
+		str = *end == ',' ? end + 1 : end;
+	}
+	if (n == 0) die("No atom counts given.");
+	return n;
+}
+
+// parse a comma-separated list of WIDTHxHEIGHT. returns the number of them.
+static unsigned parse_grids(char const *str, Grid *grids, unsigned max_grids) {
+	unsigned n = 0;
+	while (*str && n < max_grids) {
+		char *end = NULL;
+		long w = strtol(str, &end, 10);
+		if (*end != 'x') die("Bad grid size (should be WIDTHxHEIGHT): %s", str);
+		long h = strtol(end + 1, &end, 10);
+		if (w <= 0 || h <= 0) die("Bad grid size: %s", str);
+		grids[n].width = (int)w;
+		grids[n].height = (int)h;
+		++n;
+		str = *end == ',' ? end + 1 : end;
+	}
+	if (n == 0) die("No grid sizes given.");
+	return n;
+}
+
+static void usage(char const *program) {
+	printf("Usage: %s [options]\n"
+		"  --atoms N,N,...     numbers of atoms (default 10000,100000,1000000,10000000)\n"
+		"  --grids WxH,...     universe sizes (default 100x56,400x225,1600x900)\n"
+		"  --steps N           least steps to time for each size (default 5)\n"
+		"  --min-time S        least seconds to spend timing each size (default 1)\n"
+		"  --threads N         threads to step with, 0 = one per CPU (default 1)\n"
+		"  --seed N            seed for the random numbers (default 0)\n"
+		"  --json FILE         where to write the results as JSON, - for stdout (default bench.json)\n"
+		"  --perf              also count cycles, instructions and cache and branch misses with hardware\n"
+		"                      performance counters (on the calling thread only, so use --threads 1)\n",
+		program);
+}
+
+#define MAX_SIZES 16
+
+int main(int argc, char **argv) {
+	AtomID atom_counts[MAX_SIZES] = {10000, 100000, 1000000, 10000000};
+	unsigned n_atom_counts = 4;
+	Grid grids[MAX_SIZES] = {{100, 56}, {400, 225}, {1600, 900}};
+	unsigned n_grids = 3;
+	unsigned long min_steps = 5;
+	double min_seconds = 1;
+	char const *json_filename = "bench.json";
+	bool perf = false;
+	UniverseSettings settings = {0};
+	settings.average_heat_per_cell = 10.0f;
+	settings.random_heat = true;
+	settings.n_threads = 1;
+	for (int i = 1; i < argc; ++i) {
+		char const *arg = argv[i];
+		if (strcmp(arg, "--atoms") == 0 && i + 1 < argc) {
+			n_atom_counts = parse_atom_counts(argv[++i], atom_counts, MAX_SIZES);
+		} else if (strcmp(arg, "--grids") == 0 && i + 1 < argc) {
+			n_grids = parse_grids(argv[++i], grids, MAX_SIZES);
+		} else if (strcmp(arg, "--steps") == 0 && i + 1 < argc) {
+			min_steps = strtoul(argv[++i], NULL, 10);
+			if (min_steps < 1) min_steps = 1;
+		} else if (strcmp(arg, "--min-time") == 0 && i + 1 < argc) {
+			min_seconds = strtod(argv[++i], NULL);
+		} else if (strcmp(arg, "--threads") == 0 && i + 1 < argc) {
+			settings.n_threads = (unsigned)strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(arg, "--seed") == 0 && i + 1 < argc) {
+			settings.seed = strtoull(argv[++i], NULL, 0);
+		} else if (strcmp(arg, "--json") == 0 && i + 1 < argc) {
+			json_filename = argv[++i];
+		} else if (strcmp(arg, "--perf") == 0) {
+			perf = true;
+		} else if (strcmp(arg, "--help") == 0) {
+			usage(argv[0]);
+			return 0;
+		} else {
+			usage(argv[0]);
+			die("Unrecognized argument: %s", arg);
+		}
+	}
+
+	unsigned n_results = n_atom_counts * n_grids;
+	Result *results = memory_allocate(Result, n_results, MEMORY_OTHER);
+	unsigned n_threads = settings.n_threads ? settings.n_threads : os_n_cpus();
+	table_out = strcmp(json_filename, "-") == 0 ? stderr : stdout;
+	if (perf) {
+		counters = perf_available();
+		if (!counters)
+			fprintf(stderr, "Hardware performance counters aren't available here; only timing.\n");
+	}
+	fprintf(table_out, "%u thread%s\n", n_threads, n_threads == 1 ? "" : "s");
+	print_header();
+	Universe *u = NULL;
+	for (unsigned a = 0; a < n_atom_counts; ++a) {
+		for (unsigned g = 0; g < n_grids; ++g) {
+			settings.n_atoms = atom_counts[a];
+			settings.width = grids[g].width;
+			settings.height = grids[g].height;
+			Result *r = &results[a * n_grids + g];
+			// one universe is reused for every size, like a parameter sweep would
+			if (u)
+				universe_reset(u, &settings);
+			else
+				u = universe_create(&settings);
+			run(r, u, 1.0f / 60.0f, min_steps, min_seconds);
+			print_result(r);
+		}
+	}
+	if (u)
+		universe_destroy(u);
+	if (!write_json(json_filename, results, n_results, n_threads))
+		die("Couldn't write %s.", json_filename);
+	memory_free(results);
+	memory_print_stats(table_out);
+	return 0;
+}
@@ -1,25 +1,222 @@
 #include "core.h"
+#include "os.h"
 
 #include <stdlib.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
-void *memory_alloc_bytes(size_t bytes) {
-	if (bytes == 0) return NULL;
+bool (*die_handler)(char const *message);
+
+static char const *const memory_tag_names[MEMORY_N_TAGS] = {
+	[MEMORY_OTHER] = "other",
+	[MEMORY_GRID] = "grid",
+	[MEMORY_ATOMS] = "atoms",
+	[MEMORY_BONDS] = "bonds",
+	[MEMORY_MOLECULES] = "molecules",
+	[MEMORY_HEATMAP] = "heatmap",
+	[MEMORY_RENDER] = "render",
+	[MEMORY_ARENA] = "arena",
+};
+
+char const *memory_tag_name(MemoryTag tag) {
+	return tag < MEMORY_N_TAGS ? memory_tag_names[tag] : "total";
+}
 
-	void *mem = calloc(1, bytes);
-	if (mem) {
-		return mem;
-	} else {
+static void *memory_check(void *mem, size_t bytes) {
+	if (!mem)
 		die("Out of memory (tried to allocate %zu bytes).", bytes);
-		return mem;
+	return mem;
+}
+
+// the alignment to really use for an allocation of the given size and flags
+static size_t memory_alignment(size_t bytes, size_t align, unsigned flags) {
+	assert(align && (align & (align - 1)) == 0);
+	// at least enough for posix_memalign, and for the accounting header just before it
+	if (align < alignof(max_align_t))
+		align = alignof(max_align_t);
+	// so the huge pages can cover the whole thing
+	if ((flags & MEMORY_HUGE_PAGES) && bytes >= HUGE_PAGE_SIZE && align < HUGE_PAGE_SIZE)
+		align = HUGE_PAGE_SIZE;
+	return align;
+}
+
+// finish off an aligned allocation: it must be advised before it's first touched
+static void *memory_aligned_init(void *mem, size_t bytes, size_t align, unsigned flags) {
+	if (align >= HUGE_PAGE_SIZE)
+		os_use_huge_pages(mem, bytes);
+	if (flags & MEMORY_ZERO)
+		memset(mem, 0, bytes);
+	return mem;
+}
+
+#if MEMORY_ACCOUNTING
+
+// kept just before each allocation. the size keeps what follows it aligned for anything.
+typedef struct {
+	alignas(max_align_t) void *base; // what to free (not the header for aligned allocations)
+	size_t bytes;
+	MemoryTag tag;
+} MemoryHeader;
+
+typedef struct {
+	atomic_size_t live, peak;
+	atomic_ullong n_allocations, n_reallocations;
+} MemoryCounters;
+
+// [MEMORY_N_TAGS] is the total
+static MemoryCounters memory_counters[MEMORY_N_TAGS + 1];
+
+static void memory_count(MemoryCounters *c, size_t old_bytes, size_t new_bytes) {
+	size_t live;
+	if (new_bytes >= old_bytes)
+		live = atomic_fetch_add_explicit(&c->live, new_bytes - old_bytes, memory_order_relaxed) + (new_bytes - old_bytes);
+	else
+		live = atomic_fetch_sub_explicit(&c->live, old_bytes - new_bytes, memory_order_relaxed) - (old_bytes - new_bytes);
+	size_t peak = atomic_load_explicit(&c->peak, memory_order_relaxed);
+	while (live > peak && !atomic_compare_exchange_weak_explicit(&c->peak, &peak, live,
+		memory_order_relaxed, memory_order_relaxed));
+}
+
+static void memory_account(MemoryTag tag, size_t old_bytes, size_t new_bytes) {
+	memory_count(&memory_counters[tag], old_bytes, new_bytes);
+	memory_count(&memory_counters[MEMORY_N_TAGS], old_bytes, new_bytes);
+}
+
+static void memory_count_call(MemoryTag tag, bool reallocated) {
+	for (int i = 0; i < 2; ++i) {
+		MemoryCounters *c = &memory_counters[i ? MEMORY_N_TAGS : tag];
+		atomic_fetch_add_explicit(reallocated ? &c->n_reallocations : &c->n_allocations, 1, memory_order_relaxed);
 	}
 }
 
-void *memory_realloc_bytes(void *mem, size_t bytes) {
-	mem = realloc(mem, bytes);
-	if (mem) {
-		return mem;
-	} else {
-		die("Out of memory (tried to allocate %zu bytes).", bytes);
-		return mem;
+void *memory_alloc_bytes(size_t bytes, MemoryTag tag) {
+	if (bytes == 0) return NULL;
+	assert(tag < MEMORY_N_TAGS);
+
+	MemoryHeader *header = memory_check(calloc(1, sizeof *header + bytes), bytes);
+	header->base = header;
+	header->bytes = bytes;
+	header->tag = tag;
+	memory_account(tag, 0, bytes);
+	memory_count_call(tag, false);
+	return header + 1;
+}
+
+void *memory_alloc_aligned(size_t bytes, size_t align, unsigned flags, MemoryTag tag) {
+	if (bytes == 0) return NULL;
+	assert(tag < MEMORY_N_TAGS);
+
+	align = memory_alignment(bytes, align, flags);
+	// put the header just before the first aligned address after it
+	char *base = memory_check(malloc(sizeof(MemoryHeader) + align - 1 + bytes), bytes);
+	uintptr_t start = ((uintptr_t)(base + sizeof(MemoryHeader)) + align - 1) & ~(uintptr_t)(align - 1);
+	MemoryHeader *header = (MemoryHeader *)start - 1;
+	header->base = base;
+	header->bytes = bytes;
+	header->tag = tag;
+	memory_account(tag, 0, bytes);
+	memory_count_call(tag, false);
+	return memory_aligned_init(header + 1, bytes, align, flags);
+}
+
+void *memory_realloc_bytes(void *mem, size_t bytes, MemoryTag tag) {
+	if (!mem) {
+		if (bytes == 0) return NULL;
+		// counted as a reallocation, since this is how growing arrays start out
+		MemoryHeader *header = memory_check(malloc(sizeof *header + bytes), bytes);
+		header->base = header;
+		header->bytes = bytes;
+		header->tag = tag;
+		memory_account(tag, 0, bytes);
+		memory_count_call(tag, true);
+		return header + 1;
 	}
+	MemoryHeader *header = (MemoryHeader *)mem - 1;
+	assert(header->base == header); // not from memory_alloc_aligned
+	size_t old_bytes = header->bytes;
+	tag = header->tag;
+	header = memory_check(realloc(header, sizeof *header + bytes), bytes);
+	header->base = header;
+	header->bytes = bytes;
+	memory_account(tag, old_bytes, bytes);
+	memory_count_call(tag, true);
+	return header + 1;
 }
+
+void memory_track(MemoryTag tag, size_t old_bytes, size_t new_bytes) {
+	assert(tag < MEMORY_N_TAGS);
+	memory_count(&memory_counters[tag], old_bytes, new_bytes);
+	if (old_bytes && new_bytes)
+		atomic_fetch_add_explicit(&memory_counters[tag].n_reallocations, 1, memory_order_relaxed);
+	else if (new_bytes)
+		atomic_fetch_add_explicit(&memory_counters[tag].n_allocations, 1, memory_order_relaxed);
+}
+
+void memory_free(void *mem) {
+	if (!mem) return;
+	MemoryHeader *header = (MemoryHeader *)mem - 1;
+	memory_account(header->tag, header->bytes, 0);
+	free(header->base);
+}
+
+bool memory_stats(MemoryTag tag, MemoryStats *stats) {
+	assert(tag <= MEMORY_N_TAGS);
+	MemoryCounters *c = &memory_counters[tag];
+	stats->live = atomic_load_explicit(&c->live, memory_order_relaxed);
+	stats->peak = atomic_load_explicit(&c->peak, memory_order_relaxed);
+	stats->n_allocations = atomic_load_explicit(&c->n_allocations, memory_order_relaxed);
+	stats->n_reallocations = atomic_load_explicit(&c->n_reallocations, memory_order_relaxed);
+	return true;
+}
+
+void memory_print_stats(FILE *fp) {
+	fprintf(fp, "%-10s %12s %12s %8s %8s\n", "memory", "live KiB", "peak KiB", "allocs", "reallocs");
+	for (int tag = 0; tag <= MEMORY_N_TAGS; ++tag) {
+		MemoryStats stats;
+		memory_stats((MemoryTag)tag, &stats);
+		fprintf(fp, "%-10s %12.1f %12.1f %8llu %8llu\n", memory_tag_name((MemoryTag)tag),
+			(double)stats.live / 1024.0, (double)stats.peak / 1024.0,
+			stats.n_allocations, stats.n_reallocations);
+	}
+}
+
+#else
+
+void *memory_alloc_bytes(size_t bytes, MemoryTag tag) {
+	if (bytes == 0) return NULL;
+	return memory_check(calloc(1, bytes), bytes);
+}
+
+void *memory_realloc_bytes(void *mem, size_t bytes, MemoryTag tag) {
+	return memory_check(realloc(mem, bytes), bytes);
+}
+
+void *memory_alloc_aligned(size_t bytes, size_t align, unsigned flags, MemoryTag tag) {
+	if (bytes == 0) return NULL;
+
+	align = memory_alignment(bytes, align, flags);
+	void *mem = NULL;
+	if (posix_memalign(&mem, align, bytes) != 0)
+		mem = NULL;
+	return memory_aligned_init(memory_check(mem, bytes), bytes, align, flags);
+}
+
+void memory_free(void *mem) {
+	free(mem);
+}
+
+bool memory_stats(MemoryTag tag, MemoryStats *stats) {
+	memset(stats, 0, sizeof *stats);
+	return false;
+}
+
+void memory_track(MemoryTag tag, size_t old_bytes, size_t new_bytes) {
+}
+
+void memory_print_stats(FILE *fp) {
+}
+
+#endif
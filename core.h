@@ -6,21 +6,19 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
 #include <assert.h>
 
-typedef struct SDL_Window SDL_Window;
+// called by die() with the error message (e.g. to show a message box).
+// if this is NULL or returns false, the message is printed to stderr instead.
+extern bool (*die_handler)(char const *message);
 
-#ifndef SDL_MESSAGEBOX_ERROR
-#define SDL_MESSAGEBOX_ERROR 0x00000010
-extern int SDL_ShowSimpleMessageBox(
-	unsigned, const char *, const char *, SDL_Window *); 
-#endif
-
-// show a message box, and if that fails, print the message instead, then exit
+// report an error, then exit
 #define die(...) do { \
 	char _str[1024] = {}; \
 	snprintf(_str, sizeof _str - 1, __VA_ARGS__); \
-	if (SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Error", _str, NULL) < 0) \
+	if (!die_handler || !die_handler(_str)) \
 		fprintf(stderr, "%s\n", _str); \
 	exit(-1); \
 } while (0)
@@ -31,11 +29,62 @@ extern int SDL_ShowSimpleMessageBox(
 #define debug_print(...) ((void)0)
 #endif
 
-// allocate memory; die on failure
-extern void *memory_alloc_bytes(size_t bytes);
-extern void *memory_realloc_bytes(void *mem, size_t bytes);
-#define memory_allocate(type, n) ((type *)memory_alloc_bytes((n) * sizeof(type)))
-#define memory_reallocate(memory, new_n) ((memory) = memory_realloc_bytes((memory), sizeof *(memory) * (new_n)))
+// what memory is used for, so usage can be accounted for separately.
+// memory handed out by arenas (see arena.h) counts towards its own tag, and the
+// arenas' chunks count towards MEMORY_ARENA, so the total is what's really allocated.
+typedef enum {
+	MEMORY_OTHER,
+	MEMORY_GRID, // the atoms in each cell
+	MEMORY_ATOMS,
+	MEMORY_BONDS, // bonds and bond proposals
+	MEMORY_MOLECULES,
+	MEMORY_HEATMAP, // heat grids and changes
+	MEMORY_RENDER, // snapshots and staging for GPU uploads
+	MEMORY_ARENA, // arenas' chunks
+	MEMORY_N_TAGS
+} MemoryTag;
+
+// allocate zeroed memory; die on failure.
+// memory must be freed with memory_free, not free.
+extern void *memory_alloc_bytes(size_t bytes, MemoryTag tag);
+// tag is only used if mem is NULL
+extern void *memory_realloc_bytes(void *mem, size_t bytes, MemoryTag tag);
+extern void memory_free(void *mem);
+#define memory_allocate(type, n, tag) ((type *)memory_alloc_bytes((n) * sizeof(type), (tag)))
+#define memory_reallocate(memory, new_n, tag) ((memory) = memory_realloc_bytes((memory), sizeof *(memory) * (new_n), (tag)))
+
+#define CACHE_LINE_SIZE 64
+// allocations at least this big can use transparent huge pages
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+enum {
+	MEMORY_ZERO = 1, // zero the memory (otherwise its contents are unspecified)
+	// back the memory with huge pages if it's big enough, to save TLB misses when sweeping over it
+	MEMORY_HUGE_PAGES = 2,
+};
+// allocate memory aligned to align (a power of 2, e.g. CACHE_LINE_SIZE), with the given
+// MEMORY_ flags; die on failure. free it with memory_free. it can't be reallocated.
+extern void *memory_alloc_aligned(size_t bytes, size_t align, unsigned flags, MemoryTag tag);
+#define memory_allocate_aligned(type, n, flags, tag) \
+	((type *)memory_alloc_aligned((n) * sizeof(type), CACHE_LINE_SIZE, (flags), (tag)))
+
+typedef struct {
+	size_t live; // bytes allocated now
+	size_t peak; // most bytes ever allocated at once
+	unsigned long long n_allocations, n_reallocations;
+} MemoryStats;
+
+// memory usage is only tracked if this is built with MEMORY_ACCOUNTING,
+// as it puts a header before every allocation.
+// returns false (and zeroes *stats) if it isn't tracked.
+// tag may be MEMORY_N_TAGS for the total over all tags.
+extern bool memory_stats(MemoryTag tag, MemoryStats *stats);
+// count memory handed out for tag by an allocator built on top of these (like an arena)
+// going from old_bytes to new_bytes. it isn't added to the total.
+extern void memory_track(MemoryTag tag, size_t old_bytes, size_t new_bytes);
+extern char const *memory_tag_name(MemoryTag tag);
+// print the usage for each tag, if it's tracked
+extern void memory_print_stats(FILE *fp);
 
 #define join3(a, b) a##b
 #define join2(a, b) join3(a, b)
@@ -0,0 +1,67 @@
+#include "cpu.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if __x86_64__ || __i386__
+#include <cpuid.h>
+
+// is the register state for mask saved by the OS? (checked with xgetbv)
+static int os_saves_state(unsigned mask) {
+	unsigned eax = 0, edx = 0;
+	__asm__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return (eax & mask) == mask;
+}
+
+static CPULevel cpu_detect(void) {
+	unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return CPU_SCALAR;
+	if (!(edx & bit_SSE2))
+		return CPU_SCALAR;
+	bool osxsave = ecx & bit_OSXSAVE;
+	bool avx = ecx & bit_AVX;
+	if (!osxsave || !avx || !os_saves_state(0x6)) // XMM + YMM
+		return CPU_SSE2;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+		return CPU_SSE2;
+	if (!(ebx & bit_AVX2))
+		return CPU_SSE2;
+	if ((ebx & bit_AVX512F) && os_saves_state(0xe6)) // XMM + YMM + opmask + ZMM
+		return CPU_AVX512;
+	return CPU_AVX2;
+}
+#else
+static CPULevel cpu_detect(void) {
+	return CPU_SCALAR;
+}
+#endif
+
+static char const *const level_names[] = {
+	[CPU_SCALAR] = "scalar",
+	[CPU_SSE2] = "sse2",
+	[CPU_AVX2] = "avx2",
+	[CPU_AVX512] = "avx512",
+};
+
+char const *cpu_level_name(CPULevel level) {
+	return level_names[level];
+}
+
+CPULevel cpu_level(void) {
+	static atomic_int level = -1;
+	if (level < 0) {
+		CPULevel detected = cpu_detect();
+		char const *cap = getenv("SIMULATOR_SIMD");
+		if (cap) {
+			for (int l = CPU_SCALAR; l <= CPU_AVX512; ++l) {
+				if (strcmp(cap, level_names[l]) == 0 && l < (int)detected)
+					detected = (CPULevel)l;
+			}
+		}
+		level = (int)detected;
+	}
+	return (CPULevel)level;
+}
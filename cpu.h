@@ -0,0 +1,18 @@
+#ifndef CPU_H_
+#define CPU_H_
+
+// instruction sets we have kernels for, from worst to best
+typedef enum {
+	CPU_SCALAR,
+	CPU_SSE2,
+	CPU_AVX2,
+	CPU_AVX512,
+} CPULevel;
+
+// the best instruction set this CPU (and OS) supports, detected with cpuid on the first call.
+// setting the environment variable SIMULATOR_SIMD to scalar, sse2, avx2 or avx512 caps it,
+// e.g. for comparing kernels against the scalar versions.
+extern CPULevel cpu_level(void);
+extern char const *cpu_level_name(CPULevel level);
+
+#endif // CPU_H_
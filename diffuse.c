@@ -0,0 +1,116 @@
+#include "diffuse.h"
+#include "cpu.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+#if __x86_64__ || __i386__
+#define DIFFUSE_X86 1
+#include <immintrin.h>
+#endif
+
+// all kernels compute
+//    hc + rate * (0.25f * (((down + up) + right) + left) - hc)
+// with the operations in exactly this order (and no fused multiply-adds), so
+// they agree bit for bit.
+
+int diffuse_stride(int width) {
+	// room for the halo, rounded up to 64 bytes so every row starts on a cache line if the first one does
+	return (width + 2 + 15) & ~15;
+}
+
+// fill in the halo of src which rows y0 <= y < y1 read from.
+// the stencil only reads the row above and below inside the grid, plus its own row's
+// ends, so bands only ever write halo cells no other band reads.
+static void diffuse_wrap_halo(float *src, int width, int height, int stride, int y0, int y1) {
+	size_t row_bytes = (size_t)width * sizeof *src;
+	if (y0 == 0)
+		memcpy(src - stride, src + (height - 1) * stride, row_bytes);
+	if (y1 == height)
+		memcpy(src + height * stride, src, row_bytes);
+	for (int y = y0; y < y1; ++y) {
+		float *row = src + y * stride;
+		row[-1] = row[width - 1];
+		row[width] = row[0];
+	}
+}
+
+static void diffuse_row_scalar(float *restrict dst, float const *restrict src, int x0, int width, int stride, float rate) {
+	for (int x = x0; x < width; ++x) {
+		float hc = src[x];
+		float sum = src[x + stride] + src[x - stride] + src[x + 1] + src[x - 1];
+		dst[x] = hc + rate * (0.25f * sum - hc);
+	}
+}
+
+#if DIFFUSE_X86
+static void diffuse_row_sse2(float *restrict dst, float const *restrict src, int width, int stride, float rate) {
+	__m128 vrate = _mm_set1_ps(rate), quarter = _mm_set1_ps(0.25f);
+	int x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128 hc = _mm_loadu_ps(&src[x]);
+		__m128 sum = _mm_add_ps(_mm_loadu_ps(&src[x + stride]), _mm_loadu_ps(&src[x - stride]));
+		sum = _mm_add_ps(sum, _mm_loadu_ps(&src[x + 1]));
+		sum = _mm_add_ps(sum, _mm_loadu_ps(&src[x - 1]));
+		__m128 diff = _mm_sub_ps(_mm_mul_ps(quarter, sum), hc);
+		_mm_storeu_ps(&dst[x], _mm_add_ps(hc, _mm_mul_ps(vrate, diff)));
+	}
+	diffuse_row_scalar(dst, src, x, width, stride, rate);
+}
+
+__attribute__((target("avx2")))
+static void diffuse_row_avx2(float *restrict dst, float const *restrict src, int width, int stride, float rate) {
+	__m256 vrate = _mm256_set1_ps(rate), quarter = _mm256_set1_ps(0.25f);
+	int x = 0;
+	for (; x + 8 <= width; x += 8) {
+		__m256 hc = _mm256_loadu_ps(&src[x]);
+		__m256 sum = _mm256_add_ps(_mm256_loadu_ps(&src[x + stride]), _mm256_loadu_ps(&src[x - stride]));
+		sum = _mm256_add_ps(sum, _mm256_loadu_ps(&src[x + 1]));
+		sum = _mm256_add_ps(sum, _mm256_loadu_ps(&src[x - 1]));
+		__m256 diff = _mm256_sub_ps(_mm256_mul_ps(quarter, sum), hc);
+		_mm256_storeu_ps(&dst[x], _mm256_add_ps(hc, _mm256_mul_ps(vrate, diff)));
+	}
+	diffuse_row_scalar(dst, src, x, width, stride, rate);
+}
+
+__attribute__((target("avx512f")))
+static void diffuse_row_avx512(float *restrict dst, float const *restrict src, int width, int stride, float rate) {
+	__m512 vrate = _mm512_set1_ps(rate), quarter = _mm512_set1_ps(0.25f);
+	int x = 0;
+	for (; x + 16 <= width; x += 16) {
+		__m512 hc = _mm512_loadu_ps(&src[x]);
+		__m512 sum = _mm512_add_ps(_mm512_loadu_ps(&src[x + stride]), _mm512_loadu_ps(&src[x - stride]));
+		sum = _mm512_add_ps(sum, _mm512_loadu_ps(&src[x + 1]));
+		sum = _mm512_add_ps(sum, _mm512_loadu_ps(&src[x - 1]));
+		__m512 diff = _mm512_sub_ps(_mm512_mul_ps(quarter, sum), hc);
+		_mm512_storeu_ps(&dst[x], _mm512_add_ps(hc, _mm512_mul_ps(vrate, diff)));
+	}
+	diffuse_row_scalar(dst, src, x, width, stride, rate);
+}
+#endif
+
+static void diffuse_row_generic(float *restrict dst, float const *restrict src, int width, int stride, float rate) {
+	diffuse_row_scalar(dst, src, 0, width, stride, rate);
+}
+
+typedef void (*DiffuseRowFn)(float *restrict, float const *restrict, int, int, float);
+
+void diffuse_rows(float *dst, float *src, int width, int height, int stride, int y0, int y1, float rate) {
+	// atomic since bands call this from several threads at once
+	static _Atomic(DiffuseRowFn) diffuse_row;
+	if (!diffuse_row) {
+		switch (cpu_level()) {
+		case CPU_SCALAR: diffuse_row = diffuse_row_generic; break;
+	#if DIFFUSE_X86
+		case CPU_SSE2: diffuse_row = diffuse_row_sse2; break;
+		case CPU_AVX2: diffuse_row = diffuse_row_avx2; break;
+		case CPU_AVX512: diffuse_row = diffuse_row_avx512; break;
+	#else
+		default: diffuse_row = diffuse_row_generic; break;
+	#endif
+		}
+	}
+	diffuse_wrap_halo(src, width, height, stride, y0, y1);
+	for (int y = y0; y < y1; ++y)
+		diffuse_row(dst + y * stride, src + y * stride, width, stride, rate);
+}
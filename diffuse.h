@@ -0,0 +1,18 @@
+#ifndef DIFFUSE_H_
+#define DIFFUSE_H_
+
+// heat dispersion kernels.
+// grids are width x height floats, with rows stride floats apart, surrounded by a
+// one-cell halo: grid[-1], grid[width], grid[-stride] and grid[height * stride]
+// (and the rest of the border) must all be valid memory.
+
+// stride to use for a grid of the given width
+extern int diffuse_stride(int width);
+// for rows y0 <= y < y1 of a width x height grid which wraps around:
+//    dst[x] = lerp(rate, src[x], average of src's 4 neighbours of x)
+// first copies the opposite edges of the grid into the parts of src's halo these
+// rows read, so disjoint bands of rows can be run on different threads at once.
+// the result is bit-identical whichever kernel is used.
+extern void diffuse_rows(float *dst, float *src, int width, int height, int stride, int y0, int y1, float rate);
+
+#endif // DIFFUSE_H_
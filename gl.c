@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 GLProcs gl;
 
@@ -13,7 +14,7 @@ void gl_get_procs(GLProcFn get_proc_address) {
 
 static GLuint shader_compile(char const *filename, GLenum type) {
 	size_t file_size = fs_file_size(filename);
-	char *code = memory_allocate(char, file_size);
+	char *code = memory_allocate(char, file_size, MEMORY_OTHER);
 	FILE *fp = fopen(filename, "rb");
 	GLuint shader = 0;
 	if (fp) {
@@ -24,7 +25,7 @@ static GLuint shader_compile(char const *filename, GLenum type) {
 
 		// prepend this before every shader
 		char const *header = 
-			"#version 130\n"
+			"#version 140\n"
 			"#define PI 3.14159265\n"
 			"#line 1\n";
 		char const *sources[] = {
@@ -52,10 +53,57 @@ static GLuint shader_compile(char const *filename, GLenum type) {
 	} else {
 		debug_print("Shader file not found: %s\n", filename);
 	}
-	free(code);
+	memory_free(code);
 	return shader;
 }
 
+static char *name_copy(char const *name) {
+	size_t length = strlen(name);
+	char *copy = memory_allocate(char, length + 1, MEMORY_OTHER);
+	memcpy(copy, name, length);
+	return copy;
+}
+
+// fill in program's tables of uniforms and attributes
+static void program_find_inputs(GLProgram *program) {
+	GLuint id = program->id;
+	GLint n_uniforms = 0, n_attributes = 0, max_uniform_length = 0, max_attribute_length = 0;
+	gl.GetProgramiv(id, GL_ACTIVE_UNIFORMS, &n_uniforms);
+	gl.GetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_uniform_length);
+	gl.GetProgramiv(id, GL_ACTIVE_ATTRIBUTES, &n_attributes);
+	gl.GetProgramiv(id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &max_attribute_length);
+	GLint max_length = max_uniform_length > max_attribute_length ? max_uniform_length : max_attribute_length;
+	char *name = memory_allocate(char, (size_t)max_length + 1, MEMORY_OTHER);
+
+	program->uniforms = memory_allocate(GLUniform, (size_t)n_uniforms, MEMORY_OTHER);
+	for (GLint i = 0; i < n_uniforms; ++i) {
+		GLint size = 0;
+		GLenum type = 0;
+		gl.GetActiveUniform(id, (GLuint)i, max_length + 1, NULL, &size, &type, name);
+		// arrays are listed as name[0]
+		char *bracket = strchr(name, '[');
+		if (bracket) *bracket = '\0';
+		GLint location = gl.GetUniformLocation(id, name);
+		if (location < 0) continue; // in a uniform block
+		GLUniform *uniform = &program->uniforms[program->n_uniforms++];
+		uniform->name = name_copy(name);
+		uniform->location = location;
+	}
+
+	program->attributes = memory_allocate(GLAttribute, (size_t)n_attributes, MEMORY_OTHER);
+	for (GLint i = 0; i < n_attributes; ++i) {
+		GLint size = 0;
+		GLenum type = 0;
+		gl.GetActiveAttrib(id, (GLuint)i, max_length + 1, NULL, &size, &type, name);
+		GLint location = gl.GetAttribLocation(id, name);
+		if (location < 0) continue; // built in, e.g. gl_VertexID
+		GLAttribute *attribute = &program->attributes[program->n_attributes++];
+		attribute->name = name_copy(name);
+		attribute->location = location;
+	}
+	memory_free(name);
+}
+
 GLProgram gl_program_new(const char *vshader_filename, const char *fshader_filename) {
 	GLProgram program = {0};
 	
@@ -73,6 +121,7 @@ GLProgram gl_program_new(const char *vshader_filename, const char *fshader_filen
 		gl.GetProgramiv(id, GL_LINK_STATUS, &status);
 		if (status) {
 			program.id = id;
+			program_find_inputs(&program);
 		} else {
 			char log[1024] = {0};
 			gl.GetProgramInfoLog(id, sizeof log - 1, NULL, log);
@@ -99,32 +148,75 @@ void gl_program_use(GLProgram program) {
 
 void gl_program_delete(GLProgram *program) {
 	gl.DeleteProgram(program->id);
-	program->id = 0;
+	for (unsigned i = 0; i < program->n_uniforms; ++i)
+		memory_free(program->uniforms[i].name);
+	for (unsigned i = 0; i < program->n_attributes; ++i)
+		memory_free(program->attributes[i].name);
+	memory_free(program->uniforms);
+	memory_free(program->attributes);
+	memset(program, 0, sizeof *program);
+}
+
+GLUniformHandle gl_program_uniform_handle(GLProgram program, char const *name) {
+	for (unsigned i = 0; i < program.n_uniforms; ++i) {
+		if (strcmp(program.uniforms[i].name, name) == 0)
+			return (GLUniformHandle)i;
+	}
+	return -1;
 }
 
-void gl_program_uniform1f(GLint loc, float v) {
-	gl.Uniform1f(loc, v);
+GLint gl_program_attribute_location(GLProgram program, char const *name) {
+	for (unsigned i = 0; i < program.n_attributes; ++i) {
+		if (strcmp(program.attributes[i].name, name) == 0)
+			return program.attributes[i].location;
+	}
+	return -1;
 }
-void gl_program_uniform2f(GLint loc, vec2 v) {
-	gl.Uniform2f(loc, v.x, v.y);
+
+// record that u is being set to value. returns false if it already has that value.
+static bool uniform_changed(GLProgram program, GLUniformHandle u, void const *value, size_t size) {
+	if (u < 0) return false;
+	assert((unsigned)u < program.n_uniforms);
+	GLUniform *uniform = &program.uniforms[u];
+	assert(size <= sizeof uniform->value);
+	if (uniform->has_value && memcmp(&uniform->value, value, size) == 0)
+		return false;
+	memcpy(&uniform->value, value, size);
+	uniform->has_value = true;
+	return true;
 }
-void gl_program_uniform3f(GLint loc, vec3 v) {
-	gl.Uniform3f(loc, v.x, v.y, v.z);
+
+void gl_program_uniform1f(GLProgram program, GLUniformHandle u, float v) {
+	if (uniform_changed(program, u, &v, sizeof v))
+		gl.Uniform1f(program.uniforms[u].location, v);
 }
-void gl_program_uniform4f(GLint loc, vec4 v) {
-	gl.Uniform4f(loc, v.x, v.y, v.z, v.w);
+void gl_program_uniform2f(GLProgram program, GLUniformHandle u, vec2 v) {
+	if (uniform_changed(program, u, &v, sizeof v))
+		gl.Uniform2f(program.uniforms[u].location, v.x, v.y);
 }
-void gl_program_uniform1i(GLint loc, int v) {
-	gl.Uniform1i(loc, v);
+void gl_program_uniform3f(GLProgram program, GLUniformHandle u, vec3 v) {
+	if (uniform_changed(program, u, &v, sizeof v))
+		gl.Uniform3f(program.uniforms[u].location, v.x, v.y, v.z);
 }
-void gl_program_uniform2i(GLint loc, vec2i v) {
-	gl.Uniform2i(loc, v.x, v.y);
+void gl_program_uniform4f(GLProgram program, GLUniformHandle u, vec4 v) {
+	if (uniform_changed(program, u, &v, sizeof v))
+		gl.Uniform4f(program.uniforms[u].location, v.x, v.y, v.z, v.w);
 }
-void gl_program_uniform3i(GLint loc, vec3i v) {
-	gl.Uniform3i(loc, v.x, v.y, v.z);
+void gl_program_uniform1i(GLProgram program, GLUniformHandle u, int v) {
+	if (uniform_changed(program, u, &v, sizeof v))
+		gl.Uniform1i(program.uniforms[u].location, v);
 }
-void gl_program_uniform4i(GLint loc, vec4i v) {
-	gl.Uniform4i(loc, v.x, v.y, v.z, v.w);
+void gl_program_uniform2i(GLProgram program, GLUniformHandle u, vec2i v) {
+	if (uniform_changed(program, u, &v, sizeof v))
+		gl.Uniform2i(program.uniforms[u].location, v.x, v.y);
+}
+void gl_program_uniform3i(GLProgram program, GLUniformHandle u, vec3i v) {
+	if (uniform_changed(program, u, &v, sizeof v))
+		gl.Uniform3i(program.uniforms[u].location, v.x, v.y, v.z);
+}
+void gl_program_uniform4i(GLProgram program, GLUniformHandle u, vec4i v) {
+	if (uniform_changed(program, u, &v, sizeof v))
+		gl.Uniform4i(program.uniforms[u].location, v.x, v.y, v.z, v.w);
 }
 
 // how many vbos/vaos/etc to generate at a time
@@ -196,6 +288,16 @@ void gl_vbo_set_stream_data(GLVBO *vbo, const void *data, size_t count) {
 	vbo_set_data(vbo, data, count, GL_STREAM_DRAW);
 }
 
+void gl_vbo_set_dynamic_data(GLVBO *vbo, const void *data, size_t count) {
+	vbo_set_data(vbo, data, count, GL_DYNAMIC_DRAW);
+}
+
+void gl_vbo_set_sub_data(GLVBO *vbo, const void *data, size_t first, size_t count) {
+	assert(first + count <= vbo->count);
+	gl.BindBuffer(GL_ARRAY_BUFFER, vbo->id);
+	gl.BufferSubData(GL_ARRAY_BUFFER, (GLintptr)(first * vbo->type_size), (GLsizeiptr)(count * vbo->type_size), data);
+}
+
 void gl_vbo_delete(GLVBO *vbo) {
 	buffer_delete(vbo->id);
 	vbo->id = 0;
@@ -203,6 +305,154 @@ void gl_vbo_delete(GLVBO *vbo) {
 	vbo->type_size = 0;
 }
 
+static bool has_extension(char const *name) {
+	GLint n = 0;
+	gl.GetIntegerv(GL_NUM_EXTENSIONS, &n);
+	for (GLint i = 0; i < n; ++i) {
+		char const *ext = (char const *)gl.GetStringi(GL_EXTENSIONS, (GLuint)i);
+		if (ext && strcmp(ext, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+// can buffers be persistently mapped?
+static bool has_buffer_storage(void) {
+	static int cached = -1;
+	if (cached < 0) {
+		GLint major = 0, minor = 0;
+		gl.GetIntegerv(GL_MAJOR_VERSION, &major);
+		gl.GetIntegerv(GL_MINOR_VERSION, &minor);
+		cached = gl.BufferStorage && (major > 4 || (major == 4 && minor >= 4) || has_extension("GL_ARB_buffer_storage"));
+	}
+	return cached;
+}
+
+#define PERSISTENT_MAP_FLAGS (GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT)
+
+static void fence_wait(GLsync fence) {
+	while (1) {
+		GLenum status = gl.ClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		if (status != GL_TIMEOUT_EXPIRED) break;
+	}
+}
+
+GLStreamBuffer gl_stream_buffer_new_with_type_size(size_t size) {
+	assert(size < GLUINT_MAX);
+	GLStreamBuffer stream = {0};
+	stream.type_size = (GLuint)size;
+	stream.persistent = has_buffer_storage();
+	stream.slot = GL_STREAM_SLOTS - 1;
+	return stream;
+}
+
+static void stream_buffer_free_slots(GLStreamBuffer *stream) {
+	for (int i = 0; i < GL_STREAM_SLOTS; ++i) {
+		if (stream->fences[i]) {
+			gl.DeleteSync(stream->fences[i]);
+			stream->fences[i] = NULL;
+		}
+		if (stream->buffers[i]) {
+			if (stream->mappings[i]) {
+				gl.BindBuffer(GL_ARRAY_BUFFER, stream->buffers[i]);
+				gl.UnmapBuffer(GL_ARRAY_BUFFER);
+				stream->mappings[i] = NULL;
+			}
+			buffer_delete(stream->buffers[i]);
+			stream->buffers[i] = 0;
+		}
+	}
+	stream->capacity = 0;
+}
+
+// make each slot big enough for count items
+static void stream_buffer_reserve(GLStreamBuffer *stream, size_t count) {
+	if (count <= stream->capacity) return;
+	size_t capacity = stream->capacity * 2 > count ? stream->capacity * 2 : count;
+	assert(capacity < GLINT_MAX / stream->type_size); // check for overflow
+	GLsizeiptr bytes = (GLsizeiptr)(capacity * stream->type_size);
+	// the old slots might still be in use, but deleting them is safe; the driver keeps them
+	// around until the GPU is done
+	stream_buffer_free_slots(stream);
+	++stream->generation;
+	for (int i = 0; i < GL_STREAM_SLOTS; ++i) {
+		stream->buffers[i] = buffer_new();
+		gl.BindBuffer(GL_ARRAY_BUFFER, stream->buffers[i]);
+		if (stream->persistent) {
+			gl.BufferStorage(GL_ARRAY_BUFFER, bytes, NULL, PERSISTENT_MAP_FLAGS);
+			stream->mappings[i] = gl.MapBufferRange(GL_ARRAY_BUFFER, 0, bytes, PERSISTENT_MAP_FLAGS);
+			if (!stream->mappings[i])
+				die("Couldn't map stream buffer.");
+		} else {
+			gl.BufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+		}
+	}
+	stream->capacity = capacity;
+}
+
+void *gl_stream_buffer_map(GLStreamBuffer *stream, size_t max_count) {
+	// always have some room, since mapping 0 bytes is an error
+	stream_buffer_reserve(stream, max_count ? max_count : 1);
+	unsigned slot = stream->slot = (stream->slot + 1) % GL_STREAM_SLOTS;
+	if (stream->fences[slot]) {
+		// the GPU might still be drawing from this slot
+		fence_wait(stream->fences[slot]);
+		gl.DeleteSync(stream->fences[slot]);
+		stream->fences[slot] = NULL;
+	}
+	if (stream->persistent)
+		return stream->mappings[slot];
+	gl.BindBuffer(GL_ARRAY_BUFFER, stream->buffers[slot]);
+	// no need for the driver to synchronize, since we've waited for the fence
+	void *data = gl.MapBufferRange(GL_ARRAY_BUFFER, 0, (GLsizeiptr)(stream->capacity * stream->type_size),
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (!data)
+		die("Couldn't map stream buffer.");
+	return data;
+}
+
+GLVBO gl_stream_buffer_unmap(GLStreamBuffer *stream, size_t count) {
+	assert(count <= stream->capacity);
+	unsigned slot = stream->slot;
+	if (!stream->persistent) {
+		gl.BindBuffer(GL_ARRAY_BUFFER, stream->buffers[slot]);
+		gl.UnmapBuffer(GL_ARRAY_BUFFER);
+	}
+	GLVBO vbo = {0};
+	vbo.id = stream->buffers[slot];
+	vbo.count = (GLuint)count;
+	vbo.type_size = stream->type_size;
+	return vbo;
+}
+
+GLuint gl_stream_buffer_texture(GLStreamBuffer *stream, GLenum internal_format) {
+	unsigned slot = stream->slot;
+	assert(stream->buffers[slot]);
+	if (!stream->textures[slot])
+		gl.GenTextures(1, &stream->textures[slot]);
+	gl.BindTexture(GL_TEXTURE_BUFFER, stream->textures[slot]);
+	if (stream->texture_generations[slot] != stream->generation) {
+		// the slot's buffer has been replaced since the texture was pointed at it
+		gl.TexBuffer(GL_TEXTURE_BUFFER, internal_format, stream->buffers[slot]);
+		stream->texture_generations[slot] = stream->generation;
+	}
+	return stream->textures[slot];
+}
+
+void gl_stream_buffer_fence(GLStreamBuffer *stream) {
+	unsigned slot = stream->slot;
+	if (stream->fences[slot])
+		gl.DeleteSync(stream->fences[slot]);
+	stream->fences[slot] = gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void gl_stream_buffer_delete(GLStreamBuffer *stream) {
+	stream_buffer_free_slots(stream);
+	gl.DeleteTextures(GL_STREAM_SLOTS, stream->textures);
+	memset(stream->textures, 0, sizeof stream->textures);
+	stream->type_size = 0;
+}
+
 GLIBO gl_ibo_new(const GLuint *indices, size_t n) {
 	GLIBO ibo = {0};
 	assert(n < GLINT_MAX);
@@ -222,62 +472,92 @@ void gl_ibo_delete(GLIBO *ibo) {
 GLVAO gl_vao_new(GLProgram program) {
 	GLVAO vao = {0};
 	assert(program.id);
-	vao.program_id = program.id;
+	vao.program = program;
 	vao.id = array_new();
 	return vao;
 }
 
-void gl_vao_add_data_with_offset(GLVAO *vao, GLVBO vbo, const char *attr_name,
-	size_t type_size, size_t member_offset, int n_elements, GLenum element_kind) {
+static void vao_add_data(GLVAO *vao, GLVBO vbo, const char *attr_name,
+	size_t type_size, size_t member_offset, int n_elements, GLenum element_kind, GLuint divisor) {
 	assert(type_size == vbo.type_size);
-	assert(vao->count == 0 || vao->count == vbo.count);
-	vao->count = vbo.count;
 	gl.BindVertexArray(vao->id);
 	gl.BindBuffer(GL_ARRAY_BUFFER, vbo.id);
-	GLint location = gl.GetAttribLocation(vao->program_id, attr_name);
+	GLint location = gl_program_attribute_location(vao->program, attr_name);
 	if (location >= 0) {
 		switch (element_kind) {
 		case GL_FLOAT:
 			gl.VertexAttribPointer((GLuint)location, n_elements, GL_FLOAT, 0, (GLsizei)type_size,
 				(const GLvoid *)member_offset);
 			break;
-		case GL_INT:
-			gl.VertexAttribIPointer((GLuint)location, n_elements, GL_INT, (GLsizei)type_size,
+		default:
+			// integer types
+			gl.VertexAttribIPointer((GLuint)location, n_elements, element_kind, (GLsizei)type_size,
 				(const GLvoid *)member_offset);
 			break;
 		}
+		gl.VertexAttribDivisor((GLuint)location, divisor);
 		gl.EnableVertexAttribArray((GLuint)location);
 	} else {
 		debug_print("Couldn't find vertex attribute: %s\n", attr_name);
 	}
 }
 
-static void gl_vao_render_with_mode(GLVAO vao, GLIBO const *ibo, GLenum mode) {
-	gl_check_program_in_use(vao.program_id);
+void gl_vao_add_data_with_offset(GLVAO *vao, GLVBO vbo, const char *attr_name,
+	size_t type_size, size_t member_offset, int n_elements, GLenum element_kind) {
+	vao_add_data(vao, vbo, attr_name, type_size, member_offset, n_elements, element_kind, 0);
+}
+
+void gl_vao_add_instance_data_with_offset(GLVAO *vao, GLVBO vbo, const char *attr_name,
+	size_t type_size, size_t member_offset, int n_elements, GLenum element_kind) {
+	vao_add_data(vao, vbo, attr_name, type_size, member_offset, n_elements, element_kind, 1);
+}
+
+static void gl_vao_render_with_mode(GLVAO vao, GLIBO const *ibo, GLuint count, GLenum mode) {
+	gl_check_program_in_use(vao.program.id);
 	gl.BindVertexArray(vao.id);
 	if (ibo) {
+		assert(count <= ibo->count);
 		gl.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo->id);
-		gl.DrawElements(mode, (GLsizei)ibo->count, GL_UNSIGNED_INT, NULL);
+		gl.DrawElements(mode, (GLsizei)count, GL_UNSIGNED_INT, NULL);
 	} else {
-		gl.DrawArrays(mode, 0, (GLsizei)vao.count);
+		gl.DrawArrays(mode, 0, (GLsizei)count);
 	}
 }
 
-void gl_vao_render(GLVAO vao, GLIBO const *ibo) {
-	gl_vao_render_with_mode(vao, ibo, GL_TRIANGLES);
+void gl_vao_render(GLVAO vao, GLIBO const *ibo, GLuint count) {
+	gl_vao_render_with_mode(vao, ibo, count, GL_TRIANGLES);
+}
+
+void gl_vao_render_lines(GLVAO vao, GLIBO const *ibo, GLuint count) {
+	gl_vao_render_with_mode(vao, ibo, count, GL_LINES);
+}
+
+void gl_vao_render_points(GLVAO vao, GLIBO const *ibo, GLuint count) {
+	gl_vao_render_with_mode(vao, ibo, count, GL_POINTS);
+}
+
+static void gl_vao_render_instanced_with_mode(GLVAO vao, GLIBO const *ibo, GLuint count, GLuint n_instances, GLenum mode) {
+	gl_check_program_in_use(vao.program.id);
+	gl.BindVertexArray(vao.id);
+	if (ibo) {
+		assert(count <= ibo->count);
+		gl.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo->id);
+		gl.DrawElementsInstanced(mode, (GLsizei)count, GL_UNSIGNED_INT, NULL, (GLsizei)n_instances);
+	} else {
+		gl.DrawArraysInstanced(mode, 0, (GLsizei)count, (GLsizei)n_instances);
+	}
 }
 
-void gl_vao_render_lines(GLVAO vao, GLIBO const *ibo) {
-	gl_vao_render_with_mode(vao, ibo, GL_LINES);
+void gl_vao_render_instanced(GLVAO vao, GLIBO const *ibo, GLuint count, GLuint n_instances) {
+	gl_vao_render_instanced_with_mode(vao, ibo, count, n_instances, GL_TRIANGLES);
 }
 
-void gl_vao_clear(GLVAO *vao) {
-	vao->count = 0;
+void gl_vao_render_lines_instanced(GLVAO vao, GLIBO const *ibo, GLuint count, GLuint n_instances) {
+	gl_vao_render_instanced_with_mode(vao, ibo, count, n_instances, GL_LINES);
 }
 
 void gl_vao_delete(GLVAO *vao) {
 	array_delete(vao->id);
 	vao->id = 0;
-	vao->count = 0;
-	vao->program_id = 0;
+	memset(&vao->program, 0, sizeof vao->program);
 }
@@ -19,6 +19,8 @@
 	f(Clear, CLEAR) \
 	f(BindBuffer, BINDBUFFER) \
 	f(BufferData, BUFFERDATA) \
+	f(BufferSubData, BUFFERSUBDATA) \
+	f(BufferStorage, BUFFERSTORAGE) \
 	f(GenBuffers, GENBUFFERS) \
 	f(DeleteBuffers, DELETEBUFFERS) \
 	f(GetError, GETERROR) \
@@ -40,6 +42,9 @@
 	f(UniformMatrix4fv, UNIFORMMATRIX4FV) \
 	f(UseProgram, USEPROGRAM) \
 	f(DrawElements, DRAWELEMENTS) \
+	f(DrawElementsInstanced, DRAWELEMENTSINSTANCED) \
+	f(DrawArraysInstanced, DRAWARRAYSINSTANCED) \
+	f(VertexAttribDivisor, VERTEXATTRIBDIVISOR) \
 	f(CreateShader, CREATESHADER) \
 	f(ShaderSource, SHADERSOURCE) \
 	f(GetShaderiv, GETSHADERIV) \
@@ -52,10 +57,13 @@
 	f(AttachShader, ATTACHSHADER) \
 	f(LinkProgram, LINKPROGRAM) \
 	f(GetAttribLocation, GETATTRIBLOCATION) \
+	f(GetActiveUniform, GETACTIVEUNIFORM) \
+	f(GetActiveAttrib, GETACTIVEATTRIB) \
 	f(CompileShader, COMPILESHADER) \
 	f(Enable, ENABLE) \
 	f(Disable, DISABLE) \
 	f(GetIntegerv, GETINTEGERV) \
+	f(GetStringi, GETSTRINGI) \
 	f(DebugMessageCallback, DEBUGMESSAGECALLBACK) \
 	f(DebugMessageControl, DEBUGMESSAGECONTROL) \
 	f(DrawArrays, DRAWARRAYS) \
@@ -72,9 +80,18 @@
 	f(DeleteTextures, DELETETEXTURES) \
 	f(BindTexture, BINDTEXTURE) \
 	f(TexImage2D, TEXIMAGE2D) \
+	f(TexSubImage2D, TEXSUBIMAGE2D) \
+	f(TexBuffer, TEXBUFFER) \
 	f(TexImage2DMultisample, TEXIMAGE2DMULTISAMPLE) \
 	f(ActiveTexture, ACTIVETEXTURE) \
 	f(TexParameteri, TEXPARAMETERI) \
+	f(PixelStorei, PIXELSTOREI) \
+	f(ReadPixels, READPIXELS) \
+	f(MapBufferRange, MAPBUFFERRANGE) \
+	f(UnmapBuffer, UNMAPBUFFER) \
+	f(FenceSync, FENCESYNC) \
+	f(ClientWaitSync, CLIENTWAITSYNC) \
+	f(DeleteSync, DELETESYNC) \
 	f(GenerateMipmap, GENERATEMIPMAP) \
 	f(BlendFunc, BLENDFUNC) \
 	f(BlendEquation, BLENDEQUATION) \
@@ -93,22 +110,51 @@ typedef void *(*GLProcFn)(char const *);
 
 extern void gl_get_procs(GLProcFn get_proc_address);
 
+// a uniform of a program, found when it's linked
+typedef struct {
+	char *name;
+	GLint location;
+	bool has_value; // has value been sent yet?
+	// the last value sent, so that sending the same value again can be skipped
+	union {
+		float f[4];
+		GLint i[4];
+	} value;
+} GLUniform;
+
+typedef struct {
+	char *name;
+	GLint location;
+} GLAttribute;
+
 typedef struct {
 	GLuint id;
+	// the program's active uniforms and attributes, so they don't need to be looked up
+	// with the driver by name
+	GLUniform *uniforms;
+	GLAttribute *attributes;
+	unsigned n_uniforms, n_attributes;
 } GLProgram;
 
+// index into a program's uniforms, or -1 if it doesn't have the uniform
+typedef int GLUniformHandle;
+
 // make a new shader program with a vertex and fragment shader from files
 extern GLProgram gl_program_new(const char *vshader_filename, const char *fshader_filename);
 extern void gl_program_use(GLProgram program);
 extern void gl_program_delete(GLProgram *program);
-extern void gl_program_uniform1f(GLint loc, float x);
-extern void gl_program_uniform2f(GLint loc, vec2 x);
-extern void gl_program_uniform3f(GLint loc, vec3 x);
-extern void gl_program_uniform4f(GLint loc, vec4 x);
-extern void gl_program_uniform1i(GLint loc, int x);
-extern void gl_program_uniform2i(GLint loc, vec2i x);
-extern void gl_program_uniform3i(GLint loc, vec3i x);
-extern void gl_program_uniform4i(GLint loc, vec4i x);
+extern GLUniformHandle gl_program_uniform_handle(GLProgram program, char const *name);
+// -1 if the program doesn't have the attribute
+extern GLint gl_program_attribute_location(GLProgram program, char const *name);
+// these do nothing if the uniform already has the value (or if u is -1)
+extern void gl_program_uniform1f(GLProgram program, GLUniformHandle u, float x);
+extern void gl_program_uniform2f(GLProgram program, GLUniformHandle u, vec2 x);
+extern void gl_program_uniform3f(GLProgram program, GLUniformHandle u, vec3 x);
+extern void gl_program_uniform4f(GLProgram program, GLUniformHandle u, vec4 x);
+extern void gl_program_uniform1i(GLProgram program, GLUniformHandle u, int x);
+extern void gl_program_uniform2i(GLProgram program, GLUniformHandle u, vec2i x);
+extern void gl_program_uniform3i(GLProgram program, GLUniformHandle u, vec3i x);
+extern void gl_program_uniform4i(GLProgram program, GLUniformHandle u, vec4i x);
 
 #if DEBUG
 extern GLuint gl_program_in_use;
@@ -118,19 +164,25 @@ extern GLuint gl_program_in_use;
 #define gl_check_program_in_use(must_be) ((void)0)
 #endif
 
+// set a uniform from a handle. the program must be in use.
+#define gl_program_uniform_set(program, handle, value) do {\
+	gl_check_program_in_use((program).id);\
+	_Generic((value),\
+		float: gl_program_uniform1f,\
+		vec2: gl_program_uniform2f,\
+		vec3: gl_program_uniform3f,\
+		vec4: gl_program_uniform4f,\
+		int: gl_program_uniform1i,\
+		vec2i: gl_program_uniform2i,\
+		vec3i: gl_program_uniform3i,\
+		vec4i: gl_program_uniform4i)(program, handle, value);\
+	} while (0)
+
+// set a uniform by name (looked up in the program's table, not with the driver)
 #define gl_program_uniform(program, u_name, value) do {\
-	GLint _loc = gl.GetUniformLocation(program.id, u_name);\
-	gl_check_program_in_use(program.id);\
-	if (_loc >= 0) {\
-		_Generic((value),\
-			float: gl_program_uniform1f,\
-			vec2: gl_program_uniform2f,\
-			vec3: gl_program_uniform3f,\
-			vec4: gl_program_uniform4f,\
-			int: gl_program_uniform1i,\
-			vec2i: gl_program_uniform2i,\
-			vec3i: gl_program_uniform3i,\
-			vec4i: gl_program_uniform4i)(_loc, value);\
+	GLUniformHandle _u = gl_program_uniform_handle(program, u_name);\
+	if (_u >= 0) {\
+		gl_program_uniform_set(program, _u, value);\
 	} else {\
 		debug_print("Uniform not found: %s\n", u_name);\
 	}\
@@ -148,8 +200,47 @@ extern GLVBO gl_vbo_new_with_type_size(size_t size);
 #define gl_vbo_new(type) gl_vbo_new_with_type_size(sizeof(type))
 extern void gl_vbo_set_static_data(GLVBO *vbo, const void *data, size_t count);
 extern void gl_vbo_set_stream_data(GLVBO *vbo, const void *data, size_t count);
+// for data which will be updated a bit at a time with gl_vbo_set_sub_data
+extern void gl_vbo_set_dynamic_data(GLVBO *vbo, const void *data, size_t count);
+// replace items first ... first+count-1, which must be within the data already set
+extern void gl_vbo_set_sub_data(GLVBO *vbo, const void *data, size_t first, size_t count);
 extern void gl_vbo_delete(GLVBO *vbo);
 
+// for data which is regenerated every frame: a ring of GL_STREAM_SLOTS buffers, so the
+// CPU can write one while the GPU is still drawing from the others. each slot is fenced
+// after it's drawn from, and only waited on when the ring comes back around to it.
+// the slots stay mapped if the driver supports persistent mapping (GL 4.4 or
+// ARB_buffer_storage); otherwise they're mapped unsynchronized each time.
+#define GL_STREAM_SLOTS 3
+typedef struct {
+	GLuint buffers[GL_STREAM_SLOTS];
+	GLsync fences[GL_STREAM_SLOTS];
+	void *mappings[GL_STREAM_SLOTS]; // only if persistent
+	// buffer textures reading each slot, made by gl_stream_buffer_texture
+	GLuint textures[GL_STREAM_SLOTS];
+	unsigned texture_generations[GL_STREAM_SLOTS];
+	GLuint type_size;
+	size_t capacity; // # of items each slot has room for
+	unsigned slot; // the slot last written
+	// incremented whenever the buffers are replaced (when they grow), so that anything
+	// pointing at them (e.g. a VAO for each slot) knows to update
+	unsigned generation;
+	bool persistent;
+} GLStreamBuffer;
+
+extern GLStreamBuffer gl_stream_buffer_new_with_type_size(size_t size);
+#define gl_stream_buffer_new(type) gl_stream_buffer_new_with_type_size(sizeof(type))
+// get the next slot to write up to max_count items into, growing the buffers if needed.
+// the data can be written directly, and must be finished with gl_stream_buffer_unmap.
+extern void *gl_stream_buffer_map(GLStreamBuffer *stream, size_t max_count);
+// finish writing count items. returns the slot's buffer, to use like any other GLVBO.
+extern GLVBO gl_stream_buffer_unmap(GLStreamBuffer *stream, size_t count);
+// a buffer texture reading the slot last written, with the given format (e.g. GL_R32F)
+extern GLuint gl_stream_buffer_texture(GLStreamBuffer *stream, GLenum internal_format);
+// call after the draws which use the data, so its slot won't be overwritten until they're done
+extern void gl_stream_buffer_fence(GLStreamBuffer *stream);
+extern void gl_stream_buffer_delete(GLStreamBuffer *stream);
+
 typedef struct {
 	GLuint id;
 	GLuint count;
@@ -158,34 +249,44 @@ typedef struct {
 GLIBO gl_ibo_new(const GLuint *indices, size_t n);
 void gl_ibo_delete(GLIBO *ibo);
 
+// a VAO's layout is set up once with gl_vao_add_data; how much to draw is given to
+// gl_vao_render, so the buffers' contents can change without touching the VAO.
 typedef struct {
 	GLuint id;
-	GLuint count;
-	GLuint program_id;
+	GLProgram program;
 } GLVAO;
 
 extern GLVAO gl_vao_new(GLProgram program);
 extern void gl_vao_add_data_with_offset(GLVAO *vao, GLVBO vbo, const char *attr_name, size_t type_size, size_t member_offset, int n_elements, GLenum element_kind);
+// like gl_vao_add_data_with_offset, but the attribute advances once per instance instead of once per vertex
+extern void gl_vao_add_instance_data_with_offset(GLVAO *vao, GLVBO vbo, const char *attr_name, size_t type_size, size_t member_offset, int n_elements, GLenum element_kind);
 
 // hooray for c11 _Generic!!!
-#define gl_vao_add_data(vao, vbo, attr_name, type, member) \
+#define gl_vao_add_data_generic(add_fn, vao, vbo, attr_name, type, member) \
 	_Generic((&((type *)0)->member), \
-		float *: gl_vao_add_data_with_offset(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 1, GL_FLOAT), \
-		vec2 *: gl_vao_add_data_with_offset(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 2, GL_FLOAT), \
-		vec3 *: gl_vao_add_data_with_offset(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 3, GL_FLOAT), \
-		vec4 *: gl_vao_add_data_with_offset(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 4, GL_FLOAT), \
-		int *: gl_vao_add_data_with_offset(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 1, GL_INT), \
-		vec2i *: gl_vao_add_data_with_offset(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 2, GL_INT), \
-		vec3i *: gl_vao_add_data_with_offset(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 3, GL_INT), \
-		vec4i *: gl_vao_add_data_with_offset(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 4, GL_INT))
-		
-
-// pass NULL for ibo to just use indices 0, 1, 2, ... count-1
+		float *: add_fn(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 1, GL_FLOAT), \
+		vec2 *: add_fn(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 2, GL_FLOAT), \
+		vec3 *: add_fn(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 3, GL_FLOAT), \
+		vec4 *: add_fn(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 4, GL_FLOAT), \
+		int *: add_fn(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 1, GL_INT), \
+		vec2i *: add_fn(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 2, GL_INT), \
+		vec3i *: add_fn(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 3, GL_INT), \
+		vec4i *: add_fn(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 4, GL_INT), \
+		unsigned *: add_fn(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 1, GL_UNSIGNED_INT), \
+		unsigned char *: add_fn(vao, vbo, attr_name, sizeof(type), offsetof(type, member), 1, GL_UNSIGNED_BYTE))
+#define gl_vao_add_data(vao, vbo, attr_name, type, member) \
+	gl_vao_add_data_generic(gl_vao_add_data_with_offset, vao, vbo, attr_name, type, member)
+#define gl_vao_add_instance_data(vao, vbo, attr_name, type, member) \
+	gl_vao_add_data_generic(gl_vao_add_instance_data_with_offset, vao, vbo, attr_name, type, member)
+
+// draw count indices from ibo, or pass NULL for ibo to just use indices 0, 1, 2, ... count-1
 // make sure you are using vao's program before calling this!
-extern void gl_vao_render(GLVAO vao, GLIBO const *ibo);
-extern void gl_vao_render_lines(GLVAO vao, GLIBO const *ibo);
-// reset count to 0, you will need to do this if the number of elements changes
-extern void gl_vao_clear(GLVAO *vao);
+extern void gl_vao_render(GLVAO vao, GLIBO const *ibo, GLuint count);
+extern void gl_vao_render_lines(GLVAO vao, GLIBO const *ibo, GLuint count);
+extern void gl_vao_render_points(GLVAO vao, GLIBO const *ibo, GLuint count);
+// draw n_instances copies of the triangles/lines
+extern void gl_vao_render_instanced(GLVAO vao, GLIBO const *ibo, GLuint count, GLuint n_instances);
+extern void gl_vao_render_lines_instanced(GLVAO vao, GLIBO const *ibo, GLuint count, GLuint n_instances);
 extern void gl_vao_delete(GLVAO *vao);
 
 // call this when you're done with OpenGL
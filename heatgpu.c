@@ -0,0 +1,209 @@
+#include "heatgpu.h"
+
+#include <string.h>
+
+typedef struct {
+	vec2 pos;
+} QuadVertex;
+
+typedef struct {
+	vec2 pos;
+	float heat;
+} HeatChangeVertex;
+
+// add the heat changes bonding has made since the last call into the current texture,
+// by drawing a point for each one with additive blending
+static void apply_heat_changes(HeatGPU *h) {
+	Universe *u = h->u;
+	if (u->n_heat_changes == 0) return;
+	if (h->readback_pending) {
+		// the read back won't include these, but they're already in the CPU copy it'll overwrite
+		unsigned n = h->n_late_changes + u->n_heat_changes;
+		if (n > h->late_changes_capacity)
+			memory_reallocate(h->late_changes, h->late_changes_capacity = n * 2, MEMORY_RENDER);
+		memcpy(&h->late_changes[h->n_late_changes], u->heat_changes, u->n_heat_changes * sizeof *h->late_changes);
+		h->n_late_changes = n;
+	}
+	HeatChangeVertex *data = memory_allocate(HeatChangeVertex, u->n_heat_changes, MEMORY_RENDER);
+	for (unsigned i = 0; i < u->n_heat_changes; ++i) {
+		HeatChange const *change = &u->heat_changes[i];
+		unsigned x = change->cell % (unsigned)u->width, y = change->cell / (unsigned)u->width;
+		// the center of the cell's pixel
+		data[i].pos = Vec2(((float)x + 0.5f) * 2.0f / (float)u->width - 1.0f,
+			((float)y + 0.5f) * 2.0f / (float)u->height - 1.0f);
+		data[i].heat = change->heat;
+	}
+	gl_vbo_set_stream_data(&h->vbo_heat_changes, data, u->n_heat_changes);
+	memory_free(data);
+
+	gl.BindFramebuffer(GL_FRAMEBUFFER, h->framebuffers[h->current]);
+	gl.Viewport(0, 0, u->width, u->height);
+	gl.Enable(GL_BLEND);
+	gl.BlendFunc(GL_ONE, GL_ONE);
+	gl_program_use(h->program_heat_change);
+	gl_vao_render_points(h->vao_heat_changes, NULL, u->n_heat_changes);
+	gl.Disable(GL_BLEND);
+	u->n_heat_changes = 0;
+}
+
+// called by universe_step instead of dispersing heat on the CPU
+static void heat_gpu_diffuse(Universe *u, void *userdata) {
+	HeatGPU *h = userdata;
+	assert(h->u == u);
+	// changes from the last step happened after its dispersion, so apply them first
+	apply_heat_changes(h);
+	int next = 1 - h->current;
+	gl.BindFramebuffer(GL_FRAMEBUFFER, h->framebuffers[next]);
+	gl.Viewport(0, 0, u->width, u->height);
+	gl_program_use(h->program_dispersion);
+	gl.ActiveTexture(GL_TEXTURE0);
+	gl.BindTexture(GL_TEXTURE_2D, h->textures[h->current]);
+	gl_program_uniform_set(h->program_dispersion, h->uniform_prev_heatmap, 0);
+	gl_program_uniform_set(h->program_dispersion, h->uniform_dispersion_speed, 0.03f);
+	gl_vao_render(h->vao_quad, &h->ibo_quad, h->ibo_quad.count);
+	h->current = next;
+}
+
+bool heat_gpu_init(HeatGPU *h, Universe *u) {
+	memset(h, 0, sizeof *h);
+	h->u = u;
+
+	// the heatmap has padding at the end of each row
+	gl.PixelStorei(GL_UNPACK_ROW_LENGTH, u->heatmap_stride);
+	gl.GenTextures(2, h->textures);
+	gl.GenFramebuffers(2, h->framebuffers);
+	bool complete = true;
+	for (int i = 0; i < 2; ++i) {
+		gl.BindTexture(GL_TEXTURE_2D, h->textures[i]);
+		gl.TexImage2D(GL_TEXTURE_2D, 0, GL_R32F, u->width, u->height, 0, GL_RED, GL_FLOAT, u->heatmap);
+		gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		// the universe wraps around
+		gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		gl.BindFramebuffer(GL_FRAMEBUFFER, h->framebuffers[i]);
+		gl.FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, h->textures[i], 0);
+		if (gl.CheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			complete = false;
+	}
+	gl.PixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	gl.BindFramebuffer(GL_FRAMEBUFFER, 0);
+	h->program_dispersion = gl_program_new("assets/dispersionv.glsl", "assets/dispersionf.glsl");
+	h->program_heat_change = gl_program_new("assets/heatchangev.glsl", "assets/heatchangef.glsl");
+	if (!complete || !h->program_dispersion.id || !h->program_heat_change.id) {
+		heat_gpu_destroy(h);
+		return false;
+	}
+
+	{
+		QuadVertex vertices[] = {
+			{{-1, -1}},
+			{{1, -1}},
+			{{1, 1}},
+			{{-1, 1}}
+		};
+		GLuint indices[] = {
+			0, 1, 2,
+			0, 2, 3
+		};
+		h->vao_quad = gl_vao_new(h->program_dispersion);
+		h->vbo_quad = gl_vbo_new(QuadVertex);
+		h->ibo_quad = gl_ibo_new(indices, 6);
+		gl_vbo_set_static_data(&h->vbo_quad, vertices, sizeof vertices / sizeof *vertices);
+		gl_vao_add_data(&h->vao_quad, h->vbo_quad, "v_pos", QuadVertex, pos);
+	}
+	h->uniform_prev_heatmap = gl_program_uniform_handle(h->program_dispersion, "u_prev_heatmap");
+	h->uniform_dispersion_speed = gl_program_uniform_handle(h->program_dispersion, "u_dispersion_speed");
+	h->vao_heat_changes = gl_vao_new(h->program_heat_change);
+	h->vbo_heat_changes = gl_vbo_new(HeatChangeVertex);
+	gl_vao_add_data(&h->vao_heat_changes, h->vbo_heat_changes, "v_pos", HeatChangeVertex, pos);
+	gl_vao_add_data(&h->vao_heat_changes, h->vbo_heat_changes, "v_heat", HeatChangeVertex, heat);
+
+	gl.GenBuffers(1, &h->readback_buffer);
+	gl.BindBuffer(GL_PIXEL_PACK_BUFFER, h->readback_buffer);
+	gl.BufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)((size_t)u->heatmap_stride * (size_t)u->height * sizeof(float)),
+		NULL, GL_STREAM_READ);
+	gl.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	u->diffuse = heat_gpu_diffuse;
+	u->diffuse_userdata = h;
+	u->n_heat_changes = 0;
+	return true;
+}
+
+void heat_gpu_begin_frame(HeatGPU *h) {
+	if (!h->readback_pending) return;
+	if (h->readback_fence) {
+		GLenum status = gl.ClientWaitSync(h->readback_fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			return; // not there yet; try again next frame
+		gl.DeleteSync(h->readback_fence);
+		h->readback_fence = NULL;
+	}
+	Universe *u = h->u;
+	size_t stride = (size_t)u->heatmap_stride;
+	gl.BindBuffer(GL_PIXEL_PACK_BUFFER, h->readback_buffer);
+	float const *heat = gl.MapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+		(GLsizeiptr)(stride * (size_t)u->height * sizeof(float)), GL_MAP_READ_BIT);
+	if (heat) {
+		// the read back includes every heat change made before it, and the ones made
+		// since are redone, so the copy is up to date apart from the dispersion done since then
+		for (int y = 0; y < u->height; ++y)
+			memcpy(&u->heatmap[(size_t)y * stride], &heat[(size_t)y * stride], (size_t)u->width * sizeof(float));
+		gl.UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		for (unsigned i = 0; i < h->n_late_changes; ++i) {
+			HeatChange const *change = &h->late_changes[i];
+			unsigned x = change->cell % (unsigned)u->width, y = change->cell / (unsigned)u->width;
+			u->heatmap[(size_t)y * stride + x] += change->heat;
+		}
+	}
+	gl.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	h->n_late_changes = 0;
+	h->readback_pending = false;
+}
+
+void heat_gpu_end_frame(HeatGPU *h) {
+	Universe *u = h->u;
+	apply_heat_changes(h);
+	if (!h->readback_pending) {
+		gl.BindFramebuffer(GL_FRAMEBUFFER, h->framebuffers[h->current]);
+		gl.BindBuffer(GL_PIXEL_PACK_BUFFER, h->readback_buffer);
+		gl.PixelStorei(GL_PACK_ROW_LENGTH, u->heatmap_stride);
+		gl.ReadPixels(0, 0, u->width, u->height, GL_RED, GL_FLOAT, NULL);
+		gl.PixelStorei(GL_PACK_ROW_LENGTH, 0);
+		gl.BindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		// without sync objects, mapping the buffer next frame will just wait for it
+		if (gl.FenceSync)
+			h->readback_fence = gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		h->readback_pending = true;
+	}
+	gl.BindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+GLuint heat_gpu_texture(HeatGPU const *h) {
+	return h->textures[h->current];
+}
+
+void heat_gpu_destroy(HeatGPU *h) {
+	if (h->u && h->u->diffuse == heat_gpu_diffuse) {
+		h->u->diffuse = NULL;
+		h->u->diffuse_userdata = NULL;
+	}
+	if (h->readback_fence)
+		gl.DeleteSync(h->readback_fence);
+	if (h->readback_buffer)
+		gl.DeleteBuffers(1, &h->readback_buffer);
+	memory_free(h->late_changes);
+	if (h->vao_quad.id) {
+		gl_vao_delete(&h->vao_quad);
+		gl_vbo_delete(&h->vbo_quad);
+		gl_ibo_delete(&h->ibo_quad);
+		gl_vao_delete(&h->vao_heat_changes);
+		gl_vbo_delete(&h->vbo_heat_changes);
+	}
+	if (h->program_dispersion.id) gl_program_delete(&h->program_dispersion);
+	if (h->program_heat_change.id) gl_program_delete(&h->program_heat_change);
+	gl.DeleteFramebuffers(2, h->framebuffers);
+	gl.DeleteTextures(2, h->textures);
+	memset(h, 0, sizeof *h);
+}
@@ -0,0 +1,43 @@
+#ifndef HEATGPU_H_
+#define HEATGPU_H_
+
+#include "gl.h"
+#include "universe.h"
+
+// disperses a universe's heat on the GPU, by rendering the dispersion shader from one
+// texture into the other and back. the CPU copy of the heat (which bonding reads) is
+// read back asynchronously, so it's usually a frame behind.
+typedef struct {
+	Universe *u;
+	GLProgram program_dispersion, program_heat_change;
+	GLUniformHandle uniform_prev_heatmap, uniform_dispersion_speed;
+	GLVBO vbo_quad;
+	GLIBO ibo_quad;
+	GLVAO vao_quad;
+	GLVBO vbo_heat_changes;
+	GLVAO vao_heat_changes;
+	GLuint textures[2];
+	GLuint framebuffers[2]; // framebuffers[i] renders into textures[i]
+	int current; // which texture holds the current heat
+	GLuint readback_buffer;
+	GLsync readback_fence; // set while a read back is in flight
+	bool readback_pending;
+	// heat changes made since the read back in flight started, which it doesn't include,
+	// to redo on the CPU copy once it arrives
+	HeatChange *late_changes;
+	unsigned n_late_changes, late_changes_capacity;
+} HeatGPU;
+
+// set up textures holding u's heat, and make u disperse its heat with them.
+// returns false (leaving u alone) if the GPU can't render into float textures.
+extern bool heat_gpu_init(HeatGPU *h, Universe *u);
+// call before stepping: copies the heat read back last frame into u->heatmap, if it's arrived
+extern void heat_gpu_begin_frame(HeatGPU *h);
+// call after stepping: applies the last heat changes and starts reading the heat back.
+// leaves the default framebuffer bound.
+extern void heat_gpu_end_frame(HeatGPU *h);
+// the texture holding the current heat
+extern GLuint heat_gpu_texture(HeatGPU const *h);
+extern void heat_gpu_destroy(HeatGPU *h);
+
+#endif // HEATGPU_H_
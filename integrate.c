@@ -0,0 +1,70 @@
+#include "integrate.h"
+#include "cpu.h"
+
+#include <stdatomic.h>
+
+#if __x86_64__ || __i386__
+#define INTEGRATE_X86 1
+#include <immintrin.h>
+#endif
+
+static void integrate_scalar(float *restrict pos, float const *restrict vel, size_t n, float dt, float size) {
+	for (size_t i = 0; i < n; ++i) {
+		float p = pos[i] + vel[i] * dt;
+		if (p < 0) p += size;
+		if (p >= size) p -= size;
+		pos[i] = p;
+	}
+}
+
+#if INTEGRATE_X86
+// the wrap is done with compare masks instead of branches:
+//   p += size & (p < 0)
+//   p -= size & (p >= size)
+// in that order, so that a tiny negative p which rounds up to size after adding
+// still wraps back to 0.
+
+static void integrate_sse2(float *restrict pos, float const *restrict vel, size_t n, float dt, float size) {
+	__m128 vdt = _mm_set1_ps(dt), vsize = _mm_set1_ps(size), zero = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128 p = _mm_add_ps(_mm_loadu_ps(&pos[i]), _mm_mul_ps(_mm_loadu_ps(&vel[i]), vdt));
+		p = _mm_add_ps(p, _mm_and_ps(_mm_cmplt_ps(p, zero), vsize));
+		p = _mm_sub_ps(p, _mm_and_ps(_mm_cmpge_ps(p, vsize), vsize));
+		_mm_storeu_ps(&pos[i], p);
+	}
+	integrate_scalar(pos + i, vel + i, n - i, dt, size);
+}
+
+__attribute__((target("avx2")))
+static void integrate_avx2(float *restrict pos, float const *restrict vel, size_t n, float dt, float size) {
+	__m256 vdt = _mm256_set1_ps(dt), vsize = _mm256_set1_ps(size), zero = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 p = _mm256_add_ps(_mm256_loadu_ps(&pos[i]), _mm256_mul_ps(_mm256_loadu_ps(&vel[i]), vdt));
+		p = _mm256_add_ps(p, _mm256_and_ps(_mm256_cmp_ps(p, zero, _CMP_LT_OQ), vsize));
+		p = _mm256_sub_ps(p, _mm256_and_ps(_mm256_cmp_ps(p, vsize, _CMP_GE_OQ), vsize));
+		_mm256_storeu_ps(&pos[i], p);
+	}
+	integrate_scalar(pos + i, vel + i, n - i, dt, size);
+}
+#endif
+
+typedef void (*IntegrateFn)(float *restrict, float const *restrict, size_t, float, float);
+
+void integrate_positions(float *pos, float const *vel, size_t n, float dt, float size) {
+	static _Atomic(IntegrateFn) integrate;
+	if (!integrate) {
+		switch (cpu_level()) {
+		case CPU_SCALAR: integrate = integrate_scalar; break;
+	#if INTEGRATE_X86
+		case CPU_SSE2: integrate = integrate_sse2; break;
+		case CPU_AVX2:
+		case CPU_AVX512: integrate = integrate_avx2; break;
+	#else
+		default: integrate = integrate_scalar; break;
+	#endif
+		}
+	}
+	integrate(pos, vel, n, dt, size);
+}
@@ -0,0 +1,11 @@
+#ifndef INTEGRATE_H_
+#define INTEGRATE_H_
+
+#include <stddef.h>
+
+// pos[i] += vel[i] * dt for i < n, wrapping pos into [0, size).
+// works on one coordinate at a time (call it once for x, once for y).
+// velocities must be small enough that atoms move less than size per step.
+extern void integrate_positions(float *pos, float const *vel, size_t n, float dt, float size);
+
+#endif // INTEGRATE_H_
@@ -2,7 +2,10 @@
 
 #if __unix__
 
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <math.h>
 
 size_t fs_file_size(char const *filename) {
 	struct stat statbuf = {0};
@@ -10,6 +13,18 @@ size_t fs_file_size(char const *filename) {
 	return (size_t)statbuf.st_size;
 }
 
+unsigned os_n_cpus(void) {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned)n : 1;
+}
+
+void os_use_huge_pages(void *mem, size_t bytes) {
+#ifdef MADV_HUGEPAGE
+	// just a hint: this fails harmlessly if transparent huge pages are turned off
+	madvise(mem, bytes, MADV_HUGEPAGE);
+#endif
+}
+
 Time time_now(void) {
 	Time ts = {0};
 	clock_gettime(CLOCK_MONOTONIC, &ts);
@@ -21,6 +36,22 @@ double time_sub(Time a, Time b) {
 		+ 1e-9 * (double)(a.tv_nsec - b.tv_nsec);
 }
 
+unsigned long long time_now_ns(void) {
+	Time t = time_now();
+	return (unsigned long long)t.tv_sec * 1000000000ull + (unsigned long long)t.tv_nsec;
+}
+
+Time time_add(Time t, double seconds) {
+	double whole = floor(seconds);
+	t.tv_sec += (time_t)whole;
+	t.tv_nsec += (long)((seconds - whole) * 1e9);
+	if (t.tv_nsec >= 1000000000) {
+		t.tv_sec += 1;
+		t.tv_nsec -= 1000000000;
+	}
+	return t;
+}
+
 #else
 #error "@TODO"
 
@@ -13,8 +13,18 @@ typedef struct timespec Time;
 #error "@TODO"
 #endif
 
+// number of CPUs currently online
+extern unsigned os_n_cpus(void);
+// ask for the given memory to be backed by huge pages, if the OS can do that.
+// mem should be HUGE_PAGE_SIZE aligned and not touched yet.
+extern void os_use_huge_pages(void *mem, size_t bytes);
+
 extern Time time_now(void);
 // returns a value in seconds
 extern double time_sub(Time a, Time b);
+// returns t plus the given number of seconds
+extern Time time_add(Time t, double seconds);
+// the time in nanoseconds, from the same clock as time_now
+extern unsigned long long time_now_ns(void);
 
 #endif // OS_H_
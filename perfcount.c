@@ -0,0 +1,104 @@
+#include "perfcount.h"
+#include "core.h"
+
+#include <string.h>
+
+static char const *const perf_counter_names[PERF_N_COUNTERS] = {
+	[PERF_CYCLES] = "cycles",
+	[PERF_INSTRUCTIONS] = "instructions",
+	[PERF_L1D_MISSES] = "l1d_misses",
+	[PERF_LLC_MISSES] = "llc_misses",
+	[PERF_BRANCH_MISSES] = "branch_misses",
+};
+
+char const *perf_counter_name(PerfCounter counter) {
+	return perf_counter_names[counter];
+}
+
+#if __linux__
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// the counters are opened as one group, so they're scheduled together and read with one syscall
+typedef struct {
+	bool opened;
+	int leader; // -1 if no counters could be opened
+	unsigned n; // # of counters in the group
+	PerfCounter order[PERF_N_COUNTERS]; // which counter each value read from the group is
+	unsigned available;
+} PerfThread;
+
+// the file descriptors are left open until the process exits
+static _Thread_local PerfThread perf_thread;
+
+static void perf_open(PerfThread *t) {
+	static struct { unsigned type; unsigned long long config; } const events[PERF_N_COUNTERS] = {
+		[PERF_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+		[PERF_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+		[PERF_L1D_MISSES] = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+			| (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+		[PERF_LLC_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+		[PERF_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+	};
+	t->opened = true;
+	t->leader = -1;
+	for (int c = 0; c < PERF_N_COUNTERS; ++c) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof attr);
+		attr.size = sizeof attr;
+		attr.type = events[c].type;
+		attr.config = events[c].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		long fd = syscall(SYS_perf_event_open, &attr, 0, -1, t->leader, 0);
+		if (fd < 0) continue; // e.g. this CPU doesn't have it, or we're in a VM
+		if (t->leader < 0)
+			t->leader = (int)fd;
+		t->order[t->n++] = (PerfCounter)c;
+		t->available |= 1u << c;
+	}
+}
+
+void perf_read(PerfCounts *counts) {
+	PerfThread *t = &perf_thread;
+	if (!t->opened)
+		perf_open(t);
+	memset(counts, 0, sizeof *counts);
+	if (t->leader < 0) return;
+	// nr, time enabled, time running, then the counters in the order they were opened
+	unsigned long long data[3 + PERF_N_COUNTERS];
+	if (read(t->leader, data, sizeof data) < (ssize_t)((3 + t->n) * sizeof *data))
+		return;
+	unsigned long long enabled = data[1], running = data[2];
+	if (running == 0) return; // the group couldn't be scheduled
+	for (unsigned i = 0; i < t->n && i < data[0]; ++i) {
+		unsigned long long value = data[3 + i];
+		// if the counters had to share the hardware with something else, scale them up
+		// to estimate the whole time
+		if (running < enabled)
+			value = (unsigned long long)((double)value * (double)enabled / (double)running);
+		counts->value[t->order[i]] = value;
+	}
+}
+
+unsigned perf_available(void) {
+	PerfThread *t = &perf_thread;
+	if (!t->opened)
+		perf_open(t);
+	return t->available;
+}
+
+#else
+
+void perf_read(PerfCounts *counts) {
+	memset(counts, 0, sizeof *counts);
+}
+
+unsigned perf_available(void) {
+	return 0;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef PERFCOUNT_H_
+#define PERFCOUNT_H_
+
+#include <stdbool.h>
+
+// hardware performance counters for the calling thread, for finding out why code is
+// slow (e.g. whether it's waiting on memory). uses perf_event_open on Linux.
+// counters which can't be opened (in most VMs, without permission, or on other OSes)
+// just read as 0.
+
+typedef enum {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES, // L1 data cache read misses
+	PERF_LLC_MISSES, // last level cache misses
+	PERF_BRANCH_MISSES,
+	PERF_N_COUNTERS
+} PerfCounter;
+
+typedef struct {
+	unsigned long long value[PERF_N_COUNTERS];
+} PerfCounts;
+
+// read the calling thread's counters, which are opened the first time this is called on each thread.
+// they only count user-space work done by the thread.
+extern void perf_read(PerfCounts *counts);
+// bit (1 << counter) is set for each counter that could be opened on the calling thread
+extern unsigned perf_available(void);
+extern char const *perf_counter_name(PerfCounter counter);
+
+#endif // PERFCOUNT_H_
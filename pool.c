@@ -0,0 +1,109 @@
+#include "pool.h"
+#include "core.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+struct ThreadPool {
+	unsigned n_threads;
+	pthread_t *workers; // n_threads - 1 of these
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond; // signalled when a job starts (or on quit)
+	pthread_cond_t done_cond; // signalled when the last worker finishes a job
+	unsigned generation; // incremented for each job
+	unsigned busy_workers; // workers which haven't finished the current job yet
+	bool quit;
+
+	// the current job
+	PoolTaskFn fn;
+	void *userdata;
+	unsigned n_tasks;
+	atomic_uint next_task;
+};
+
+static void pool_do_tasks(ThreadPool *pool) {
+	while (1) {
+		unsigned task = atomic_fetch_add_explicit(&pool->next_task, 1, memory_order_relaxed);
+		if (task >= pool->n_tasks) break;
+		pool->fn(pool->userdata, task);
+	}
+}
+
+static void *pool_worker(void *arg) {
+	ThreadPool *pool = arg;
+	unsigned seen_generation = 0;
+	pthread_mutex_lock(&pool->mutex);
+	while (1) {
+		while (pool->generation == seen_generation && !pool->quit)
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+		if (pool->quit) break;
+		seen_generation = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		pool_do_tasks(pool);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->busy_workers == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+ThreadPool *pool_create(unsigned n_threads) {
+	ThreadPool *pool = memory_allocate(ThreadPool, 1, MEMORY_OTHER);
+	if (n_threads < 1) n_threads = 1;
+	pool->n_threads = n_threads;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	pool->workers = memory_allocate(pthread_t, n_threads - 1, MEMORY_OTHER);
+	for (unsigned i = 0; i + 1 < n_threads; ++i) {
+		if (pthread_create(&pool->workers[i], NULL, pool_worker, pool) != 0)
+			die("Couldn't create worker thread.");
+	}
+	return pool;
+}
+
+unsigned pool_n_threads(ThreadPool const *pool) {
+	return pool->n_threads;
+}
+
+void pool_run(ThreadPool *pool, PoolTaskFn fn, void *userdata, unsigned n_tasks) {
+	if (pool->n_threads == 1 || n_tasks <= 1) {
+		for (unsigned task = 0; task < n_tasks; ++task)
+			fn(userdata, task);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->fn = fn;
+	pool->userdata = userdata;
+	pool->n_tasks = n_tasks;
+	atomic_store_explicit(&pool->next_task, 0, memory_order_relaxed);
+	pool->busy_workers = pool->n_threads - 1;
+	++pool->generation;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	pool_do_tasks(pool);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->busy_workers)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void pool_destroy(ThreadPool *pool) {
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	for (unsigned i = 0; i + 1 < pool->n_threads; ++i)
+		pthread_join(pool->workers[i], NULL);
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_cond_destroy(&pool->done_cond);
+	memory_free(pool->workers);
+	memory_free(pool);
+}
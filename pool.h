@@ -0,0 +1,19 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+// a persistent pool of worker threads for data-parallel loops
+
+typedef struct ThreadPool ThreadPool;
+
+// called once for each task index
+typedef void (*PoolTaskFn)(void *userdata, unsigned task);
+
+// n_threads counts the calling thread, so 1 means no workers (everything runs on the caller)
+extern ThreadPool *pool_create(unsigned n_threads);
+extern unsigned pool_n_threads(ThreadPool const *pool);
+// call fn(userdata, task) for 0 <= task < n_tasks, spread over the pool (including the calling thread).
+// returns once every task has finished. tasks may run in any order.
+extern void pool_run(ThreadPool *pool, PoolTaskFn fn, void *userdata, unsigned n_tasks);
+extern void pool_destroy(ThreadPool *pool);
+
+#endif // POOL_H_
@@ -0,0 +1,291 @@
+#include "profile.h"
+#include "os.h"
+#include "perfcount.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+// zones each thread remembers. must be a power of 2.
+#define PROFILE_RING_SIZE 16384
+// deepest zones can be nested
+#define PROFILE_MAX_DEPTH 16
+
+static char const *const profile_zone_names[PROFILE_N_ZONES] = {
+	[PROFILE_DIFFUSE] = "diffuse",
+	[PROFILE_MOVE] = "move",
+	[PROFILE_BOND] = "bond",
+	[PROFILE_PUBLISH] = "publish",
+	[PROFILE_GEOMETRY] = "geometry",
+	[PROFILE_UPLOAD] = "upload",
+	[PROFILE_DRAW] = "draw",
+	[PROFILE_SWAP] = "swap",
+};
+
+// a finished zone. the fields are atomic (and accessed with relaxed ordering, which
+// costs nothing) so profile_write_trace can read them while they're being overwritten.
+typedef struct {
+	atomic_ullong start, end; // time_now_ns
+	atomic_uint zone;
+	atomic_bool counted; // whether counts is set
+	atomic_ullong counts[PERF_N_COUNTERS]; // change in each counter over the zone
+} ProfileEvent;
+
+// every call of a zone on a thread, added up
+typedef struct {
+	atomic_ullong n_calls, ns, n_counted;
+	atomic_ullong counts[PERF_N_COUNTERS];
+} ProfileTotal;
+
+typedef struct ProfileThread {
+	struct ProfileThread *next; // in the list of every thread which has recorded anything
+	unsigned id;
+	_Atomic(char const *) name;
+	// event i (counting from the first one this thread recorded) is events[i % PROFILE_RING_SIZE].
+	// n_writing is incremented before an event is written, n_events after.
+	atomic_ullong n_writing, n_events;
+	ProfileEvent events[PROFILE_RING_SIZE];
+	ProfileTotal totals[PROFILE_N_ZONES];
+	atomic_uint counters_available; // perf_available() for this thread
+	// only used by the thread itself
+	unsigned depth;
+	// the zones which are open
+	unsigned long long open[PROFILE_MAX_DEPTH]; // start times
+	bool open_counted[PROFILE_MAX_DEPTH];
+	PerfCounts open_counts[PROFILE_MAX_DEPTH];
+} ProfileThread;
+
+// threads are added to the front and never removed (so their zones can still be
+// written out after they exit)
+static _Atomic(ProfileThread *) profile_threads;
+static atomic_uint profile_n_threads;
+// when the first thread started recording. trace times are relative to this, so they stay small.
+static atomic_ullong profile_epoch;
+static _Thread_local ProfileThread *profile_this_thread;
+static atomic_bool profile_counters;
+
+void profile_enable_counters(bool enable) {
+	atomic_store_explicit(&profile_counters, enable, memory_order_relaxed);
+}
+
+static ProfileThread *profile_thread(void) {
+	ProfileThread *t = profile_this_thread;
+	if (t) return t;
+	t = memory_allocate(ProfileThread, 1, MEMORY_OTHER);
+	memset(t, 0, sizeof *t);
+	t->id = atomic_fetch_add_explicit(&profile_n_threads, 1, memory_order_relaxed) + 1;
+	unsigned long long no_epoch = 0;
+	atomic_compare_exchange_strong_explicit(&profile_epoch, &no_epoch, time_now_ns(),
+		memory_order_relaxed, memory_order_relaxed);
+	ProfileThread *head = atomic_load_explicit(&profile_threads, memory_order_relaxed);
+	do
+		t->next = head;
+	while (!atomic_compare_exchange_weak_explicit(&profile_threads, &head, t,
+		memory_order_release, memory_order_relaxed));
+	profile_this_thread = t;
+	return t;
+}
+
+void profile_thread_name(char const *name) {
+	atomic_store_explicit(&profile_thread()->name, name, memory_order_relaxed);
+}
+
+void profile_begin(ProfileZone zone) {
+	ProfileThread *t = profile_thread();
+	if (t->depth < PROFILE_MAX_DEPTH) {
+		bool counted = atomic_load_explicit(&profile_counters, memory_order_relaxed);
+		t->open_counted[t->depth] = counted;
+		if (counted) {
+			atomic_store_explicit(&t->counters_available, perf_available(), memory_order_relaxed);
+			perf_read(&t->open_counts[t->depth]);
+		}
+		// read the time last, so the counters' overhead isn't included
+		t->open[t->depth] = time_now_ns();
+	}
+	++t->depth;
+}
+
+// only the thread itself writes to these, so they don't need read-modify-writes
+static void profile_add(atomic_ullong *total, unsigned long long value) {
+	atomic_store_explicit(total, atomic_load_explicit(total, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+void profile_end(ProfileZone zone) {
+	unsigned long long end = time_now_ns();
+	ProfileThread *t = profile_this_thread;
+	assert(t && t->depth > 0);
+	if (--t->depth >= PROFILE_MAX_DEPTH)
+		return;
+	bool counted = t->open_counted[t->depth];
+	PerfCounts counts = {0};
+	if (counted) {
+		perf_read(&counts);
+		for (int c = 0; c < PERF_N_COUNTERS; ++c)
+			counts.value[c] -= t->open_counts[t->depth].value[c];
+	}
+	unsigned long long start = t->open[t->depth];
+
+	ProfileTotal *total = &t->totals[zone];
+	profile_add(&total->n_calls, 1);
+	profile_add(&total->ns, end - start);
+	if (counted) {
+		profile_add(&total->n_counted, 1);
+		for (int c = 0; c < PERF_N_COUNTERS; ++c)
+			profile_add(&total->counts[c], counts.value[c]);
+	}
+
+	unsigned long long n = atomic_load_explicit(&t->n_events, memory_order_relaxed);
+	atomic_store_explicit(&t->n_writing, n + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	ProfileEvent *e = &t->events[n % PROFILE_RING_SIZE];
+	atomic_store_explicit(&e->start, start, memory_order_relaxed);
+	atomic_store_explicit(&e->end, end, memory_order_relaxed);
+	atomic_store_explicit(&e->zone, (unsigned)zone, memory_order_relaxed);
+	atomic_store_explicit(&e->counted, counted, memory_order_relaxed);
+	if (counted)
+		for (int c = 0; c < PERF_N_COUNTERS; ++c)
+			atomic_store_explicit(&e->counts[c], counts.value[c], memory_order_relaxed);
+	atomic_store_explicit(&t->n_events, n + 1, memory_order_release);
+}
+
+typedef struct {
+	unsigned long long start, end;
+	unsigned zone;
+	bool counted;
+	PerfCounts counts;
+} ProfileEventCopy;
+
+// copy the events thread t still has. returns the number copied.
+static unsigned profile_copy_events(ProfileThread *t, ProfileEventCopy *copy) {
+	unsigned long long n = atomic_load_explicit(&t->n_events, memory_order_acquire);
+	unsigned long long first = n > PROFILE_RING_SIZE ? n - PROFILE_RING_SIZE : 0;
+	for (unsigned long long i = first; i < n; ++i) {
+		ProfileEvent *e = &t->events[i % PROFILE_RING_SIZE];
+		ProfileEventCopy *c = &copy[i - first];
+		c->start = atomic_load_explicit(&e->start, memory_order_relaxed);
+		c->end = atomic_load_explicit(&e->end, memory_order_relaxed);
+		c->zone = atomic_load_explicit(&e->zone, memory_order_relaxed);
+		c->counted = atomic_load_explicit(&e->counted, memory_order_relaxed);
+		for (int k = 0; k < PERF_N_COUNTERS; ++k)
+			c->counts.value[k] = c->counted ? atomic_load_explicit(&e->counts[k], memory_order_relaxed) : 0;
+	}
+	// throw away any events the thread may have started overwriting while we were copying
+	atomic_thread_fence(memory_order_acquire);
+	unsigned long long n_writing = atomic_load_explicit(&t->n_writing, memory_order_relaxed);
+	unsigned long long valid = n_writing > PROFILE_RING_SIZE ? n_writing - PROFILE_RING_SIZE : 0;
+	if (valid > first) {
+		unsigned long long skip = (valid < n ? valid : n) - first;
+		memmove(copy, copy + skip, (size_t)(n - first - skip) * sizeof *copy);
+		first += skip;
+	}
+	return (unsigned)(n - first);
+}
+
+bool profile_write_trace(char const *filename) {
+	FILE *fp = fopen(filename, "w");
+	if (!fp) return false;
+	ProfileEventCopy *events = memory_allocate(ProfileEventCopy, PROFILE_RING_SIZE, MEMORY_OTHER);
+	unsigned long long epoch = atomic_load_explicit(&profile_epoch, memory_order_relaxed);
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	bool first = true;
+	for (ProfileThread *t = atomic_load_explicit(&profile_threads, memory_order_acquire); t; t = t->next) {
+		char const *name = atomic_load_explicit(&t->name, memory_order_relaxed);
+		if (name) {
+			fprintf(fp, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				first ? "" : ",\n", t->id, name);
+			first = false;
+		}
+		unsigned available = atomic_load_explicit(&t->counters_available, memory_order_relaxed);
+		unsigned n = profile_copy_events(t, events);
+		for (unsigned i = 0; i < n; ++i) {
+			ProfileEventCopy const *e = &events[i];
+			if (e->zone >= PROFILE_N_ZONES) continue;
+			fprintf(fp, "%s{\"ph\":\"X\",\"name\":\"%s\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+				first ? "" : ",\n", profile_zone_names[e->zone], t->id,
+				1e-3 * (double)(long long)(e->start - epoch), 1e-3 * (double)(e->end - e->start));
+			if (e->counted && available) {
+				fprintf(fp, ",\"args\":{");
+				char const *sep = "";
+				for (int c = 0; c < PERF_N_COUNTERS; ++c) {
+					if (!(available & (1u << c))) continue;
+					fprintf(fp, "%s\"%s\":%llu", sep, perf_counter_name((PerfCounter)c), e->counts.value[c]);
+					sep = ",";
+				}
+				unsigned both = (1u << PERF_CYCLES) | (1u << PERF_INSTRUCTIONS);
+				if ((available & both) == both && e->counts.value[PERF_CYCLES])
+					fprintf(fp, ",\"ipc\":%.3f", (double)e->counts.value[PERF_INSTRUCTIONS] / (double)e->counts.value[PERF_CYCLES]);
+				fprintf(fp, "}");
+			}
+			fprintf(fp, "}");
+			first = false;
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	memory_free(events);
+	bool ok = !ferror(fp);
+	if (fclose(fp) != 0) ok = false;
+	return ok;
+}
+
+void profile_print_summary(FILE *fp, double n_atoms, double n_cells) {
+	// add up each zone over all threads
+	typedef struct {
+		unsigned long long n_calls, ns, n_counted;
+		PerfCounts counts;
+	} Sum;
+	Sum sums[PROFILE_N_ZONES] = {0};
+	unsigned available = 0;
+	for (ProfileThread *t = atomic_load_explicit(&profile_threads, memory_order_acquire); t; t = t->next) {
+		unsigned thread_available = atomic_load_explicit(&t->counters_available, memory_order_relaxed);
+		for (int z = 0; z < PROFILE_N_ZONES; ++z) {
+			ProfileTotal *total = &t->totals[z];
+			Sum *sum = &sums[z];
+			unsigned long long n_counted = atomic_load_explicit(&total->n_counted, memory_order_relaxed);
+			sum->n_calls += atomic_load_explicit(&total->n_calls, memory_order_relaxed);
+			sum->ns += atomic_load_explicit(&total->ns, memory_order_relaxed);
+			sum->n_counted += n_counted;
+			for (int c = 0; c < PERF_N_COUNTERS; ++c)
+				sum->counts.value[c] += atomic_load_explicit(&total->counts[c], memory_order_relaxed);
+			if (n_counted)
+				available |= thread_available;
+		}
+	}
+
+	bool counted = false;
+	for (int z = 0; z < PROFILE_N_ZONES; ++z)
+		counted |= sums[z].n_counted > 0;
+	if (counted && !available)
+		fprintf(fp, "(hardware performance counters aren't available here, so only times are shown)\n");
+	fprintf(fp, "%-10s %8s %10s %10s", "zone", "calls", "total ms", "ms/call");
+	if (available & (1u << PERF_CYCLES) && available & (1u << PERF_INSTRUCTIONS))
+		fprintf(fp, " %6s", "IPC");
+	PerfCounter const misses[] = {PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_BRANCH_MISSES};
+	for (size_t m = 0; m < sizeof misses / sizeof *misses; ++m) {
+		if (!(available & (1u << misses[m]))) continue;
+		char const *name = perf_counter_name(misses[m]);
+		fprintf(fp, " %14s", name);
+		if (n_atoms > 0) fprintf(fp, " %9s", "/atom");
+		if (n_cells > 0) fprintf(fp, " %9s", "/cell");
+	}
+	fprintf(fp, "\n");
+
+	for (int z = 0; z < PROFILE_N_ZONES; ++z) {
+		Sum const *sum = &sums[z];
+		if (!sum->n_calls) continue;
+		fprintf(fp, "%-10s %8llu %10.2f %10.4f", profile_zone_names[z], sum->n_calls,
+			1e-6 * (double)sum->ns, 1e-6 * (double)sum->ns / (double)sum->n_calls);
+		double n = (double)(sum->n_counted ? sum->n_counted : 1);
+		if (available & (1u << PERF_CYCLES) && available & (1u << PERF_INSTRUCTIONS)) {
+			double cycles = (double)sum->counts.value[PERF_CYCLES];
+			fprintf(fp, " %6.2f", cycles > 0 ? (double)sum->counts.value[PERF_INSTRUCTIONS] / cycles : 0.0);
+		}
+		for (size_t m = 0; m < sizeof misses / sizeof *misses; ++m) {
+			if (!(available & (1u << misses[m]))) continue;
+			// per call
+			double per_call = (double)sum->counts.value[misses[m]] / n;
+			fprintf(fp, " %14.0f", per_call);
+			if (n_atoms > 0) fprintf(fp, " %9.4f", per_call / n_atoms);
+			if (n_cells > 0) fprintf(fp, " %9.4f", per_call / n_cells);
+		}
+		fprintf(fp, "\n");
+	}
+}
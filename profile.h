@@ -0,0 +1,42 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include "core.h"
+
+// a low-overhead profiler for seeing where steps and frames go.
+// each thread records the zones it finishes into its own ring buffer (which keeps the
+// most recent ones), and whatever's there can be written out at any time as a Chrome
+// trace, for chrome://tracing or https://ui.perfetto.dev.
+
+typedef enum {
+	PROFILE_DIFFUSE, // heat dispersion
+	PROFILE_MOVE, // atom movement and regridding
+	PROFILE_BOND, // bonding
+	PROFILE_PUBLISH, // copying the universe for drawing
+	PROFILE_GEOMETRY, // atom positions and bonds, for the GPU
+	PROFILE_UPLOAD, // the heatmap, for the GPU
+	PROFILE_DRAW,
+	PROFILE_SWAP,
+	PROFILE_N_ZONES
+} ProfileZone;
+
+// also record hardware performance counters (see perfcount.h) for each zone.
+// should be called before any zones are recorded.
+extern void profile_enable_counters(bool enable);
+extern void profile_begin(ProfileZone zone);
+extern void profile_end(ProfileZone zone);
+// profile a block: profile_zone(PROFILE_DRAW) { ... }
+// the block mustn't be left with break, return or goto.
+#define profile_zone(zone) \
+	for (bool join(_profile, __LINE__) = (profile_begin(zone), true); join(_profile, __LINE__); \
+		profile_end(zone), join(_profile, __LINE__) = false)
+// name the calling thread in traces. name must stay valid for the rest of the program.
+extern void profile_thread_name(char const *name);
+// write what has been recorded on every thread as Chrome trace_event JSON.
+// can be called from any thread, while others are recording. returns false if the file couldn't be written.
+extern bool profile_write_trace(char const *filename);
+// print totals for each zone over every thread since the program started, with the
+// counters (if enabled) per call, and per atom and per cell if n_atoms and n_cells aren't 0
+extern void profile_print_summary(FILE *fp, double n_atoms, double n_cells);
+
+#endif // PROFILE_H_
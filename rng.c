@@ -0,0 +1,202 @@
+#include "rng.h"
+#include "cpu.h"
+
+#include <stdatomic.h>
+
+#if __x86_64__ || __i386__
+#define RNG_X86 1
+#include <immintrin.h>
+#endif
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+static void philox(uint32_t const key[2], uint32_t const counter[4], uint32_t out[4]) {
+	uint32_t k0 = key[0], k1 = key[1];
+	uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+	for (int r = 0; r < PHILOX_ROUNDS; ++r) {
+		uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+		uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+		uint32_t hi0 = (uint32_t)(p0 >> 32), lo0 = (uint32_t)p0;
+		uint32_t hi1 = (uint32_t)(p1 >> 32), lo1 = (uint32_t)p1;
+		c0 = hi1 ^ c1 ^ k0;
+		c1 = lo1;
+		c2 = hi0 ^ c3 ^ k1;
+		c3 = lo0;
+		k0 += PHILOX_W0;
+		k1 += PHILOX_W1;
+	}
+	out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+}
+
+Rng rng_stream(uint64_t seed, uint64_t step, uint32_t index) {
+	Rng rng = {0};
+	rng.key[0] = (uint32_t)seed;
+	rng.key[1] = (uint32_t)(seed >> 32);
+	rng.counter[1] = index;
+	rng.counter[2] = (uint32_t)step;
+	rng.counter[3] = (uint32_t)(step >> 32);
+	rng.n_used = 4; // no block generated yet
+	return rng;
+}
+
+uint32_t rng_next(Rng *rng) {
+	if (rng->n_used == 4) {
+		philox(rng->key, rng->counter, rng->block);
+		++rng->counter[0];
+		rng->n_used = 0;
+	}
+	return rng->block[rng->n_used++];
+}
+
+static float u32_to_float(uint32_t x) {
+	return (float)(x >> 8) * (1.0f / 16777216.0f);
+}
+
+float rng_float(Rng *rng) {
+	return u32_to_float(rng_next(rng));
+}
+
+uint32_t rng_to_below(uint32_t x, uint32_t n) {
+	return (uint32_t)(((uint64_t)x * n) >> 32);
+}
+
+uint32_t rng_below(Rng *rng, uint32_t n) {
+	return rng_to_below(rng_next(rng), n);
+}
+
+// fill blocks first_block ... first_block + n_blocks - 1 of the stream into out
+static void fill_blocks_scalar(Rng const *stream, uint32_t first_block, uint32_t *out, size_t n_blocks) {
+	uint32_t counter[4] = {first_block, stream->counter[1], stream->counter[2], stream->counter[3]};
+	for (size_t b = 0; b < n_blocks; ++b, ++counter[0])
+		philox(stream->key, counter, &out[4 * b]);
+}
+
+#if RNG_X86
+// the SIMD versions run one block per 32-bit lane: vector cN holds word N of each block.
+// _mm_mul_epu32 only multiplies the even lanes, so the odd lanes are shifted down and
+// multiplied separately, then the halves of the products are recombined.
+
+static void fill_blocks_sse2(Rng const *stream, uint32_t first_block, uint32_t *out, size_t n_blocks) {
+	__m128i const m0 = _mm_set1_epi32((int)PHILOX_M0), m1 = _mm_set1_epi32((int)PHILOX_M1);
+	__m128i const even = _mm_set_epi32(0, -1, 0, -1);
+	size_t b = 0;
+	for (; b + 4 <= n_blocks; b += 4) {
+		uint32_t n = first_block + (uint32_t)b;
+		__m128i c0 = _mm_set_epi32((int)(n + 3), (int)(n + 2), (int)(n + 1), (int)n);
+		__m128i c1 = _mm_set1_epi32((int)stream->counter[1]);
+		__m128i c2 = _mm_set1_epi32((int)stream->counter[2]);
+		__m128i c3 = _mm_set1_epi32((int)stream->counter[3]);
+		uint32_t k0 = stream->key[0], k1 = stream->key[1];
+		for (int r = 0; r < PHILOX_ROUNDS; ++r) {
+			__m128i p0_even = _mm_mul_epu32(c0, m0), p0_odd = _mm_mul_epu32(_mm_srli_epi64(c0, 32), m0);
+			__m128i p1_even = _mm_mul_epu32(c2, m1), p1_odd = _mm_mul_epu32(_mm_srli_epi64(c2, 32), m1);
+			__m128i lo0 = _mm_or_si128(_mm_and_si128(p0_even, even), _mm_slli_epi64(p0_odd, 32));
+			__m128i hi0 = _mm_or_si128(_mm_srli_epi64(p0_even, 32), _mm_andnot_si128(even, p0_odd));
+			__m128i lo1 = _mm_or_si128(_mm_and_si128(p1_even, even), _mm_slli_epi64(p1_odd, 32));
+			__m128i hi1 = _mm_or_si128(_mm_srli_epi64(p1_even, 32), _mm_andnot_si128(even, p1_odd));
+			c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32((int)k0));
+			c1 = lo1;
+			c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32((int)k1));
+			c3 = lo0;
+			k0 += PHILOX_W0;
+			k1 += PHILOX_W1;
+		}
+		// transpose so each block's words are contiguous
+		__m128i t0 = _mm_unpacklo_epi32(c0, c1), t1 = _mm_unpacklo_epi32(c2, c3);
+		__m128i t2 = _mm_unpackhi_epi32(c0, c1), t3 = _mm_unpackhi_epi32(c2, c3);
+		__m128i *dst = (__m128i *)&out[4 * b];
+		_mm_storeu_si128(dst + 0, _mm_unpacklo_epi64(t0, t1));
+		_mm_storeu_si128(dst + 1, _mm_unpackhi_epi64(t0, t1));
+		_mm_storeu_si128(dst + 2, _mm_unpacklo_epi64(t2, t3));
+		_mm_storeu_si128(dst + 3, _mm_unpackhi_epi64(t2, t3));
+	}
+	fill_blocks_scalar(stream, first_block + (uint32_t)b, &out[4 * b], n_blocks - b);
+}
+
+__attribute__((target("avx2")))
+static void fill_blocks_avx2(Rng const *stream, uint32_t first_block, uint32_t *out, size_t n_blocks) {
+	__m256i const m0 = _mm256_set1_epi32((int)PHILOX_M0), m1 = _mm256_set1_epi32((int)PHILOX_M1);
+	__m256i const even = _mm256_set_epi32(0, -1, 0, -1, 0, -1, 0, -1);
+	size_t b = 0;
+	for (; b + 8 <= n_blocks; b += 8) {
+		uint32_t n = first_block + (uint32_t)b;
+		__m256i c0 = _mm256_add_epi32(_mm256_set1_epi32((int)n), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+		__m256i c1 = _mm256_set1_epi32((int)stream->counter[1]);
+		__m256i c2 = _mm256_set1_epi32((int)stream->counter[2]);
+		__m256i c3 = _mm256_set1_epi32((int)stream->counter[3]);
+		uint32_t k0 = stream->key[0], k1 = stream->key[1];
+		for (int r = 0; r < PHILOX_ROUNDS; ++r) {
+			__m256i p0_even = _mm256_mul_epu32(c0, m0), p0_odd = _mm256_mul_epu32(_mm256_srli_epi64(c0, 32), m0);
+			__m256i p1_even = _mm256_mul_epu32(c2, m1), p1_odd = _mm256_mul_epu32(_mm256_srli_epi64(c2, 32), m1);
+			__m256i lo0 = _mm256_or_si256(_mm256_and_si256(p0_even, even), _mm256_slli_epi64(p0_odd, 32));
+			__m256i hi0 = _mm256_or_si256(_mm256_srli_epi64(p0_even, 32), _mm256_andnot_si256(even, p0_odd));
+			__m256i lo1 = _mm256_or_si256(_mm256_and_si256(p1_even, even), _mm256_slli_epi64(p1_odd, 32));
+			__m256i hi1 = _mm256_or_si256(_mm256_srli_epi64(p1_even, 32), _mm256_andnot_si256(even, p1_odd));
+			c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32((int)k0));
+			c1 = lo1;
+			c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32((int)k1));
+			c3 = lo0;
+			k0 += PHILOX_W0;
+			k1 += PHILOX_W1;
+		}
+		// transpose within each 128-bit half (blocks 0-3 and 4-7), then put the halves in order
+		__m256i t0 = _mm256_unpacklo_epi32(c0, c1), t1 = _mm256_unpacklo_epi32(c2, c3);
+		__m256i t2 = _mm256_unpackhi_epi32(c0, c1), t3 = _mm256_unpackhi_epi32(c2, c3);
+		__m256i b04 = _mm256_unpacklo_epi64(t0, t1), b15 = _mm256_unpackhi_epi64(t0, t1);
+		__m256i b26 = _mm256_unpacklo_epi64(t2, t3), b37 = _mm256_unpackhi_epi64(t2, t3);
+		__m256i *dst = (__m256i *)&out[4 * b];
+		_mm256_storeu_si256(dst + 0, _mm256_permute2x128_si256(b04, b15, 0x20));
+		_mm256_storeu_si256(dst + 1, _mm256_permute2x128_si256(b26, b37, 0x20));
+		_mm256_storeu_si256(dst + 2, _mm256_permute2x128_si256(b04, b15, 0x31));
+		_mm256_storeu_si256(dst + 3, _mm256_permute2x128_si256(b26, b37, 0x31));
+	}
+	fill_blocks_scalar(stream, first_block + (uint32_t)b, &out[4 * b], n_blocks - b);
+}
+#endif
+
+typedef void (*FillBlocksFn)(Rng const *, uint32_t, uint32_t *, size_t);
+
+static FillBlocksFn fill_blocks_fn(void) {
+	static _Atomic(FillBlocksFn) fill_blocks;
+	if (!fill_blocks) {
+		switch (cpu_level()) {
+		case CPU_SCALAR: fill_blocks = fill_blocks_scalar; break;
+	#if RNG_X86
+		case CPU_SSE2: fill_blocks = fill_blocks_sse2; break;
+		case CPU_AVX2:
+		case CPU_AVX512: fill_blocks = fill_blocks_avx2; break;
+	#else
+		default: fill_blocks = fill_blocks_scalar; break;
+	#endif
+		}
+	}
+	return fill_blocks;
+}
+
+void rng_fill_u32(Rng const *stream, uint32_t *out, size_t n) {
+	size_t n_blocks = n / 4;
+	fill_blocks_fn()(stream, 0, out, n_blocks);
+	if (n % 4) {
+		uint32_t last[4];
+		fill_blocks_scalar(stream, (uint32_t)n_blocks, last, 1);
+		for (size_t i = 0; i < n % 4; ++i)
+			out[4 * n_blocks + i] = last[i];
+	}
+}
+
+void rng_fill_floats(Rng const *stream, float *out, size_t n) {
+	// generate a chunk at a time into a buffer, then convert
+	uint32_t buffer[256];
+	FillBlocksFn fill_blocks = fill_blocks_fn();
+	for (size_t start = 0; start < n; start += 256) {
+		size_t count = n - start < 256 ? n - start : 256;
+		uint32_t first_block = (uint32_t)(start / 4);
+		fill_blocks(stream, first_block, buffer, (count + 3) / 4);
+		for (size_t i = 0; i < count; ++i)
+			out[start + i] = u32_to_float(buffer[i]);
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef RNG_H_
+#define RNG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// counter-based random numbers (Philox4x32-10).
+// a stream is identified by (seed, step, index); the n'th number in it is a pure
+// function of those and n, so numbers can be generated in any order, on any thread,
+// and a parallel run gives the same results as a serial one.
+typedef struct {
+	uint32_t key[2];
+	uint32_t counter[4]; // counter[0] is the block number; the rest identify the stream
+	uint32_t block[4]; // the current block of 4 numbers
+	unsigned n_used; // how many numbers of block have been used
+} Rng;
+
+extern Rng rng_stream(uint64_t seed, uint64_t step, uint32_t index);
+extern uint32_t rng_next(Rng *rng);
+// uniform in [0, 1)
+extern float rng_float(Rng *rng);
+// uniform in [0, n)
+extern uint32_t rng_below(Rng *rng, uint32_t n);
+// map a random number to [0, n) the same way rng_below does
+extern uint32_t rng_to_below(uint32_t x, uint32_t n);
+
+// fill out with the first n numbers of a new stream (the same numbers rng_next would give),
+// several blocks at a time with SIMD
+extern void rng_fill_u32(Rng const *stream, uint32_t *out, size_t n);
+// same as rng_fill_u32 but converted with rng_float
+extern void rng_fill_floats(Rng const *stream, float *out, size_t n);
+
+#endif // RNG_H_
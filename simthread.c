@@ -0,0 +1,101 @@
+#include "simthread.h"
+#include "os.h"
+#include "profile.h"
+
+#include <pthread.h>
+
+struct SimThread {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond; // signalled when paused or quit change
+	bool paused, quit; // protected by mutex
+
+	// only used by the thread
+	Universe *u;
+	Stepper stepper;
+	SnapshotBuffer *snapshots;
+	SimPublishFn on_publish;
+	void *userdata;
+};
+
+static void *sim_thread_main(void *arg) {
+	SimThread *t = arg;
+	Stepper *stepper = &t->stepper;
+	profile_thread_name("simulation");
+	Time last = time_now();
+	pthread_mutex_lock(&t->mutex);
+	while (!t->quit) {
+		if (t->paused) {
+			pthread_cond_wait(&t->cond, &t->mutex);
+			last = time_now(); // time spent paused doesn't count
+			continue;
+		}
+		pthread_mutex_unlock(&t->mutex);
+
+		Time now = time_now();
+		unsigned n_steps = universe_advance(t->u, stepper, time_sub(now, last));
+		last = now;
+		if (n_steps) {
+			profile_begin(PROFILE_PUBLISH);
+			bool wake = snapshot_buffer_publish(t->snapshots, t->u);
+			profile_end(PROFILE_PUBLISH);
+			if (wake && t->on_publish)
+				t->on_publish(t->userdata);
+		}
+
+		pthread_mutex_lock(&t->mutex);
+		if (t->quit || t->paused)
+			continue;
+		if (stepper->speed > 0) {
+			// sleep until the next step is due
+			Time due = time_add(time_now(), (stepper->step_size - stepper->accumulator) / stepper->speed);
+			pthread_cond_timedwait(&t->cond, &t->mutex, &due);
+		} else {
+			pthread_cond_wait(&t->cond, &t->mutex);
+		}
+	}
+	pthread_mutex_unlock(&t->mutex);
+	return NULL;
+}
+
+SimThread *sim_thread_start(Universe *u, Stepper const *stepper, SnapshotBuffer *snapshots,
+	SimPublishFn on_publish, void *userdata) {
+	SimThread *t = memory_allocate(SimThread, 1, MEMORY_OTHER);
+	t->paused = false;
+	t->quit = false;
+	t->u = u;
+	t->stepper = *stepper;
+	t->snapshots = snapshots;
+	t->on_publish = on_publish;
+	t->userdata = userdata;
+	pthread_mutex_init(&t->mutex, NULL);
+	// sleeps are measured with the same clock as time_now
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&t->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	snapshot_buffer_publish(snapshots, u);
+	if (pthread_create(&t->thread, NULL, sim_thread_main, t) != 0)
+		die("Couldn't create simulation thread.");
+	return t;
+}
+
+void sim_thread_set_paused(SimThread *t, bool paused) {
+	pthread_mutex_lock(&t->mutex);
+	t->paused = paused;
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->mutex);
+}
+
+void sim_thread_stop(SimThread *t) {
+	pthread_mutex_lock(&t->mutex);
+	t->quit = true;
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->mutex);
+	pthread_join(t->thread, NULL);
+	pthread_mutex_destroy(&t->mutex);
+	pthread_cond_destroy(&t->cond);
+	memory_free(t);
+}
@@ -0,0 +1,22 @@
+#ifndef SIMTHREAD_H_
+#define SIMTHREAD_H_
+
+#include "universe.h"
+#include "snapshot.h"
+
+// steps a universe in real time on its own thread, publishing a snapshot after each batch of steps
+
+typedef struct SimThread SimThread;
+
+// called on the simulation thread when a snapshot is published and the reader had
+// already got the previous one (i.e. the reader might be waiting for it)
+typedef void (*SimPublishFn)(void *userdata);
+
+// the thread owns u until sim_thread_stop returns. a first snapshot is published before this returns.
+extern SimThread *sim_thread_start(Universe *u, Stepper const *stepper, SnapshotBuffer *snapshots,
+	SimPublishFn on_publish, void *userdata);
+extern void sim_thread_set_paused(SimThread *t, bool paused);
+// stop stepping, and wait for the thread to finish
+extern void sim_thread_stop(SimThread *t);
+
+#endif // SIMTHREAD_H_
@@ -0,0 +1,161 @@
+#include "snapshot.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+void snapshot_view(Snapshot *s, Universe *u) {
+	s->width = u->width;
+	s->height = u->height;
+	s->n_atoms = u->n_atoms;
+	s->average_heat_per_cell = u->average_heat_per_cell;
+	s->step = u->step;
+	s->x = u->atoms.x;
+	s->y = u->atoms.y;
+	s->bonds = u->bonds;
+	s->n_bonds = u->n_bonds;
+	s->generation = u->generation;
+	s->heatmap = u->heatmap;
+	s->heatmap_stride = u->heatmap_stride;
+	s->positions_dirty = u->positions_dirty;
+	s->heat_dirty_y0 = u->heat_dirty_y0;
+	s->heat_dirty_y1 = u->heat_dirty_y1;
+	u->positions_dirty = false;
+	u->heat_dirty_y0 = u->height;
+	u->heat_dirty_y1 = 0;
+}
+
+typedef struct {
+	Snapshot snapshot; // points at the arrays below
+	float *x, *y;
+	Bond *bonds;
+	unsigned bonds_capacity;
+	float *heatmap; // without padding, so heatmap_stride = width
+	// what has changed in the universe since this slot was last written.
+	// only used by the writer (even while the reader has the slot).
+	bool stale_positions;
+	int stale_y0, stale_y1;
+} SnapshotSlot;
+
+// set in middle if that slot has been published since the reader last took it
+#define SNAPSHOT_FRESH 4u
+
+struct SnapshotBuffer {
+	SnapshotSlot slots[3];
+	unsigned back; // the slot the writer fills next
+	unsigned front; // the slot the reader has
+	atomic_uint middle; // the remaining slot (| SNAPSHOT_FRESH)
+	// changes since the last snapshot the writer knows the reader took, which every
+	// snapshot has to include, since the reader may never get the ones in between
+	bool pending_positions;
+	int pending_y0, pending_y1;
+};
+
+SnapshotBuffer *snapshot_buffer_create(Universe const *u) {
+	SnapshotBuffer *b = memory_allocate(SnapshotBuffer, 1, MEMORY_RENDER);
+	memset(b, 0, sizeof *b);
+	for (int i = 0; i < 3; ++i) {
+		SnapshotSlot *slot = &b->slots[i];
+		// all filled in by the first publish, since everything starts out stale
+		slot->x = memory_allocate_aligned(float, u->n_atoms, MEMORY_HUGE_PAGES, MEMORY_RENDER);
+		slot->y = memory_allocate_aligned(float, u->n_atoms, MEMORY_HUGE_PAGES, MEMORY_RENDER);
+		slot->heatmap = memory_allocate_aligned(float, (size_t)u->width * (size_t)u->height,
+			MEMORY_HUGE_PAGES, MEMORY_RENDER);
+		slot->stale_positions = true;
+		slot->stale_y0 = 0;
+		slot->stale_y1 = u->height;
+		Snapshot *s = &slot->snapshot;
+		s->width = u->width;
+		s->height = u->height;
+		s->n_atoms = u->n_atoms;
+		s->x = slot->x;
+		s->y = slot->y;
+		s->heatmap = slot->heatmap;
+		s->heatmap_stride = u->width;
+		s->generation = u->generation;
+	}
+	b->back = 0;
+	b->front = 1;
+	atomic_init(&b->middle, 2);
+	b->pending_y0 = u->height;
+	b->pending_y1 = 0;
+	return b;
+}
+
+bool snapshot_buffer_publish(SnapshotBuffer *b, Universe *u) {
+	// whatever changed since the last publish is now out of date in every slot
+	bool moved = u->positions_dirty;
+	int y0 = u->heat_dirty_y0, y1 = u->heat_dirty_y1;
+	u->positions_dirty = false;
+	u->heat_dirty_y0 = u->height;
+	u->heat_dirty_y1 = 0;
+	for (int i = 0; i < 3; ++i) {
+		SnapshotSlot *slot = &b->slots[i];
+		slot->stale_positions |= moved;
+		slot->stale_y0 = min(slot->stale_y0, y0);
+		slot->stale_y1 = max(slot->stale_y1, y1);
+	}
+
+	SnapshotSlot *slot = &b->slots[b->back];
+	Snapshot *s = &slot->snapshot;
+	assert(s->width == u->width && s->height == u->height && s->n_atoms == u->n_atoms);
+	if (slot->stale_positions) {
+		memcpy(slot->x, u->atoms.x, u->n_atoms * sizeof *slot->x);
+		memcpy(slot->y, u->atoms.y, u->n_atoms * sizeof *slot->y);
+		slot->stale_positions = false;
+	}
+	for (int y = slot->stale_y0; y < slot->stale_y1; ++y)
+		memcpy(&slot->heatmap[y * u->width], &u->heatmap[y * u->heatmap_stride], (size_t)u->width * sizeof *slot->heatmap);
+	slot->stale_y0 = u->height;
+	slot->stale_y1 = 0;
+	// bonds are only added (until a reset), so only the ones this slot doesn't have need copying
+	unsigned n_bonds_copied = s->generation == u->generation && s->n_bonds <= u->n_bonds ? s->n_bonds : 0;
+	if (u->n_bonds > slot->bonds_capacity) {
+		memory_reallocate(slot->bonds, slot->bonds_capacity = u->bonds_capacity, MEMORY_RENDER);
+		s->bonds = slot->bonds;
+	}
+	if (u->n_bonds > n_bonds_copied)
+		memcpy(&slot->bonds[n_bonds_copied], &u->bonds[n_bonds_copied], (u->n_bonds - n_bonds_copied) * sizeof *slot->bonds);
+	s->n_bonds = u->n_bonds;
+	s->generation = u->generation;
+	s->average_heat_per_cell = u->average_heat_per_cell;
+	s->step = u->step;
+	s->positions_dirty = moved || b->pending_positions;
+	s->heat_dirty_y0 = min(y0, b->pending_y0);
+	s->heat_dirty_y1 = max(y1, b->pending_y1);
+
+	unsigned old = atomic_exchange_explicit(&b->middle, b->back | SNAPSHOT_FRESH, memory_order_acq_rel);
+	b->back = old & ~SNAPSHOT_FRESH;
+	bool read = !(old & SNAPSHOT_FRESH);
+	if (read) {
+		// the reader has the previous snapshot, so it's only missing this one's changes
+		// until it takes this one
+		b->pending_positions = moved;
+		b->pending_y0 = y0;
+		b->pending_y1 = y1;
+	} else {
+		// the reader never got the previous snapshot, and might not get this one either
+		b->pending_positions = s->positions_dirty;
+		b->pending_y0 = s->heat_dirty_y0;
+		b->pending_y1 = s->heat_dirty_y1;
+	}
+	return read;
+}
+
+Snapshot const *snapshot_buffer_acquire(SnapshotBuffer *b) {
+	if (!(atomic_load_explicit(&b->middle, memory_order_relaxed) & SNAPSHOT_FRESH))
+		return NULL;
+	unsigned old = atomic_exchange_explicit(&b->middle, b->front, memory_order_acq_rel);
+	b->front = old & ~SNAPSHOT_FRESH;
+	return &b->slots[b->front].snapshot;
+}
+
+void snapshot_buffer_destroy(SnapshotBuffer *b) {
+	for (int i = 0; i < 3; ++i) {
+		SnapshotSlot *slot = &b->slots[i];
+		memory_free(slot->x);
+		memory_free(slot->y);
+		memory_free(slot->bonds);
+		memory_free(slot->heatmap);
+	}
+	memory_free(b);
+}
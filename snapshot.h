@@ -0,0 +1,45 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include "universe.h"
+
+// what's needed to draw a universe at one point in time
+typedef struct {
+	int width, height;
+	AtomID n_atoms;
+	float average_heat_per_cell;
+	unsigned long long step;
+	float const *x, *y; // atom positions
+	// the first n_bonds of the universe's bonds, which are only ever added to until the
+	// universe is reset, which changes generation
+	Bond const *bonds;
+	unsigned n_bonds;
+	unsigned generation;
+	// cell (x, y) is heatmap[y * heatmap_stride + x]
+	float const *heatmap;
+	int heatmap_stride;
+	// what has changed since the previous snapshot the reader got
+	bool positions_dirty;
+	int heat_dirty_y0, heat_dirty_y1; // rows heat_dirty_y0 <= y < heat_dirty_y1
+} Snapshot;
+
+// point s straight at u's data, taking (and clearing) u's dirty flags.
+// for drawing a universe on the thread which steps it.
+extern void snapshot_view(Snapshot *s, Universe *u);
+
+// a lock-free triple buffer of snapshots, for one thread stepping a universe to
+// pass copies of it to one other thread drawing it, without either waiting
+typedef struct SnapshotBuffer SnapshotBuffer;
+
+// the buffer only fits universes the size of u (which it can be reset to)
+extern SnapshotBuffer *snapshot_buffer_create(Universe const *u);
+// copy what has changed in u (according to its dirty flags, which are cleared) into
+// a snapshot, and make that the latest one. only call this from the writing thread.
+// returns false if the reader hasn't got the previous snapshot yet.
+extern bool snapshot_buffer_publish(SnapshotBuffer *b, Universe *u);
+// returns the latest snapshot, or NULL if there hasn't been a new one since the last
+// call. the snapshot is valid until the next call. only call this from the reading thread.
+extern Snapshot const *snapshot_buffer_acquire(SnapshotBuffer *b);
+extern void snapshot_buffer_destroy(SnapshotBuffer *b);
+
+#endif // SNAPSHOT_H_
@@ -0,0 +1,95 @@
+// checks that a reader which only copies what snapshots say changed stays in sync
+// with the universe, however many snapshots it misses
+#include "snapshot.h"
+#include "rng.h"
+
+#include <string.h>
+
+static int failures;
+
+#define check(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAILED: " __VA_ARGS__); \
+		printf("\n"); \
+		++failures; \
+	} \
+} while (0)
+
+// change row y of u's heat, as bonding would
+static void change_row(Universe *u, int y, float heat) {
+	u->heatmap[y * u->heatmap_stride] = heat;
+	if (y < u->heat_dirty_y0) u->heat_dirty_y0 = y;
+	if (y + 1 > u->heat_dirty_y1) u->heat_dirty_y1 = y + 1;
+}
+
+// the reader takes P0, misses P1 (which changes row 3), then takes P2 (which changes row 10)
+static void test_skipped_snapshot(Universe *u) {
+	SnapshotBuffer *b = snapshot_buffer_create(u);
+	snapshot_buffer_publish(b, u);
+	check(snapshot_buffer_acquire(b), "first snapshot wasn't published");
+	change_row(u, 3, 3.0f);
+	snapshot_buffer_publish(b, u);
+	change_row(u, 10, 10.0f);
+	snapshot_buffer_publish(b, u);
+	Snapshot const *s = snapshot_buffer_acquire(b);
+	check(s, "second snapshot wasn't published");
+	if (s) {
+		check(s->heat_dirty_y0 <= 3 && s->heat_dirty_y1 >= 11,
+			"dirty rows are [%d, %d), which should include 3 and 10", s->heat_dirty_y0, s->heat_dirty_y1);
+		check(s->heatmap[3 * s->heatmap_stride] == 3.0f, "row 3 wasn't copied");
+		check(s->heatmap[10 * s->heatmap_stride] == 10.0f, "row 10 wasn't copied");
+	}
+	snapshot_buffer_destroy(b);
+}
+
+// publish and acquire in a random order, and keep a copy of the heat up to date from
+// the dirty rows alone
+static void test_random_skips(Universe *u) {
+	int width = u->width, height = u->height;
+	float *copy = memory_allocate(float, (size_t)width * (size_t)height, MEMORY_OTHER);
+	// the copy starts out empty, so the first snapshot the reader gets has to have everything
+	u->heat_dirty_y0 = 0;
+	u->heat_dirty_y1 = height;
+	SnapshotBuffer *b = snapshot_buffer_create(u);
+	Rng rng = rng_stream(1, 0, 0);
+	for (int i = 0; i < 10000; ++i) {
+		if (rng_below(&rng, 2)) {
+			int n_changes = (int)rng_below(&rng, 3);
+			for (int c = 0; c < n_changes; ++c)
+				change_row(u, (int)rng_below(&rng, (uint32_t)height), (float)i);
+			snapshot_buffer_publish(b, u);
+		} else {
+			Snapshot const *s = snapshot_buffer_acquire(b);
+			if (!s) continue;
+			for (int y = s->heat_dirty_y0; y < s->heat_dirty_y1; ++y)
+				memcpy(&copy[y * width], &s->heatmap[y * s->heatmap_stride], (size_t)width * sizeof *copy);
+			for (int y = 0; y < height; ++y) {
+				if (memcmp(&copy[y * width], &s->heatmap[y * s->heatmap_stride], (size_t)width * sizeof *copy) != 0) {
+					check(false, "row %d is out of date after %d operations", y, i);
+					i = 10000;
+					break;
+				}
+			}
+		}
+	}
+	snapshot_buffer_destroy(b);
+	memory_free(copy);
+}
+
+int main(void) {
+	UniverseSettings settings = {0};
+	settings.width = 32;
+	settings.height = 24;
+	settings.n_atoms = 100;
+	settings.seed = 1;
+	settings.average_heat_per_cell = 1.0f;
+	settings.n_threads = 1;
+	Universe *u = universe_create(&settings);
+	test_skipped_snapshot(u);
+	test_random_skips(u);
+	universe_destroy(u);
+	if (failures)
+		return 1;
+	printf("ok\n");
+	return 0;
+}
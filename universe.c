@@ -0,0 +1,575 @@
+#include "universe.h"
+#include "integrate.h"
+#include "diffuse.h"
+#include "os.h"
+#include "profile.h"
+#include "rng.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned cell_for_atom(Universe const *universe, AtomID a) {
+	int idx = universe->width * (int)universe->atoms.y[a] + (int)universe->atoms.x[a];
+	assert(idx >= 0 && idx < universe->width * universe->height);
+	return (unsigned)idx;
+}
+
+// sort atoms into cells: count atoms per cell, prefix-sum the counts, then scatter.
+// doesn't allocate, and leaves each cell's atoms in increasing order.
+static void grid_rebuild(Universe *u) {
+	unsigned n_cells = (unsigned)u->width * (unsigned)u->height;
+	unsigned *start = u->cell_start;
+	memset(start, 0, (n_cells + 1) * sizeof *start);
+	for (AtomID i = 0; i < u->n_atoms; ++i) {
+		unsigned cell = cell_for_atom(u, i);
+		u->atom_cell[i] = cell;
+		++start[cell];
+	}
+	// now start[c] = end of cell c
+	for (unsigned c = 1; c <= n_cells; ++c)
+		start[c] += start[c - 1];
+	// going backwards means start[c] ends up at the start of cell c
+	for (AtomID i = u->n_atoms; i-- > 0; )
+		u->cell_atoms[--start[u->atom_cell[i]]] = i;
+	assert(start[n_cells] == u->n_atoms);
+}
+
+static float atom_mass(unsigned char valence) {
+	switch (valence) {
+	case 1: return 1.008f;
+	case 2: return 15.999f;
+	case 3: return 14.007f;
+	case 4: return 12.011f;
+	}
+	assert(0);
+	return 0;
+}
+
+
+// follow parents to the molecule m has been merged into, compressing the path on the way
+static MoleculeID molecule_find(Universe *u, MoleculeID m) {
+	Molecule *molecules = u->molecules;
+	MoleculeID root = m;
+	while (molecules[root].parent != root)
+		root = molecules[root].parent;
+	while (molecules[m].parent != root) {
+		MoleculeID next = molecules[m].parent;
+		molecules[m].parent = root;
+		m = next;
+	}
+	return root;
+}
+
+// the molecule atom a is in now, or -1 if it isn't in one
+static MoleculeID atom_molecule(Universe *u, AtomID a) {
+	MoleculeID m = u->atoms.molecule[a];
+	if (m < 0) return m;
+	return u->atoms.molecule[a] = molecule_find(u, m);
+}
+
+static MoleculeID molecule_new(Universe *u) {
+	if (u->n_molecules >= u->molecules_capacity) {
+		MoleculeID capacity = u->molecules_capacity * 2 + 2;
+		arena_reallocate(&u->arena, u->molecules, (size_t)u->molecules_capacity, (size_t)capacity, MEMORY_MOLECULES);
+		u->molecules_capacity = capacity;
+	}
+	MoleculeID m_id = u->n_molecules++;
+	Molecule *m = &u->molecules[m_id];
+	memset(m, 0, sizeof *m);
+	m->parent = m_id;
+	m->first_atom = m->last_atom = NO_ATOM;
+	return m_id;
+}
+
+static void add_to_molecule(Universe *u, MoleculeID m_id, AtomID a_id) {
+	Molecule *m = &u->molecules[m_id];
+	assert(m->parent == m_id);
+	m->mass += atom_mass(u->atoms.valence[a_id]);
+	++m->n_atoms;
+	u->atoms.next_in_molecule[a_id] = NO_ATOM;
+	if (m->last_atom == NO_ATOM)
+		m->first_atom = a_id;
+	else
+		u->atoms.next_in_molecule[m->last_atom] = a_id;
+	m->last_atom = a_id;
+	u->atoms.molecule[a_id] = m_id;
+	assert(m->n_atoms <= u->n_atoms);
+}
+
+// join two different molecules, always merging the smaller one into the larger one.
+// returns the resulting molecule.
+static MoleculeID molecules_join(Universe *u, MoleculeID a_id, MoleculeID b_id) {
+	assert(a_id != b_id);
+	if (u->molecules[a_id].n_atoms < u->molecules[b_id].n_atoms) {
+		MoleculeID tmp = a_id;
+		a_id = b_id;
+		b_id = tmp;
+	}
+	Molecule *a = &u->molecules[a_id], *b = &u->molecules[b_id];
+	assert(a->parent == a_id && b->parent == b_id);
+	b->parent = a_id;
+	a->mass += b->mass;
+	a->n_atoms += b->n_atoms;
+	u->atoms.next_in_molecule[a->last_atom] = b->first_atom;
+	a->last_atom = b->last_atom;
+	return a_id;
+}
+
+static float bond_energy(int valence_a, int valence_b, int bond_number) {
+	if (valence_a > valence_b)
+		return bond_energy(valence_b, valence_a, bond_number);
+	float factor = 0.001f; // kJ/mol -> our energy units/bond
+	#define list(a, b, c) bond_number == 0 ? a*factor : bond_number == 1 ? b*factor : c*factor;
+	switch (valence_a) {
+	case 1:
+		switch (valence_b) {
+		case 1:
+			return list(432, 0, 0); // H-H
+		case 2:
+			return list(467, 0, 0); // H-O
+		case 3:
+			return list(391, 0, 0); // H-N
+		case 4:
+			return list(413, 0, 0); // H-C
+		}
+		break;
+	case 2:
+		switch (valence_b) {
+		case 2:
+			return list(146, 495, 0); // O-O / O=O
+		case 3:
+			return list(201, 607, 0); // O-N / O=N
+		case 4:
+			return list(358, 745, 0); // O-C / O=C
+		}
+		break;
+	case 3:
+		switch (valence_b) {
+		case 3:
+			return list(160, 418, 941); // N-N / N=N / N=-N
+		case 4:
+			return list(305, 615, 891); // N-C / N=C / N=-C
+		}
+		break;
+	case 4:
+		assert(valence_b == 4);
+		return list(347, 614, 839); // C-C / C=C / C=-C
+	}
+	assert(0);
+	return 0;
+}
+
+// # of bonds between a and b
+static unsigned char bond_order(BondedAtoms const *bonded_a, AtomID b) {
+	for (int i = 0; i < MAX_BONDED_ATOMS; ++i) {
+		if (bonded_a->order[i] && bonded_a->atom[i] == b)
+			return bonded_a->order[i];
+	}
+	return 0;
+}
+
+// record one more bond between a and b
+static void bond_order_increment(BondedAtoms *bonded_a, AtomID b) {
+	int free_slot = -1;
+	for (int i = 0; i < MAX_BONDED_ATOMS; ++i) {
+		if (bonded_a->order[i] == 0) {
+			if (free_slot < 0) free_slot = i;
+		} else if (bonded_a->atom[i] == b) {
+			++bonded_a->order[i];
+			return;
+		}
+	}
+	// there's always a free slot, since an atom can't have more bonds than its valence
+	assert(free_slot >= 0);
+	bonded_a->atom[free_slot] = b;
+	bonded_a->order[free_slot] = 1;
+}
+
+static float make_bond(Universe *u, AtomID id_a, AtomID id_b) {
+	assert(id_a != id_b);
+	Atoms *atoms = &u->atoms;
+	MoleculeID mol_a = atom_molecule(u, id_a), mol_b = atom_molecule(u, id_b);
+	float energy = 0;
+	unsigned char bond_number = 0;
+	bool already_connected = mol_a != -1 && mol_a == mol_b; // are a and b already in the same molecule?
+	if (already_connected) {
+		// double/triple bond
+		bond_number = bond_order(&atoms->bonded[id_a], id_b);
+	}
+	if (bond_number >= 3) return 0; // only allow up to triple bonds
+	energy = bond_energy(atoms->valence[id_a], atoms->valence[id_b], bond_number);
+
+	++atoms->n_bonds[id_a];
+	++atoms->n_bonds[id_b];
+	bond_order_increment(&atoms->bonded[id_a], id_b);
+	bond_order_increment(&atoms->bonded[id_b], id_a);
+
+	if (u->n_bonds >= u->bonds_capacity) {
+		unsigned capacity = u->bonds_capacity * 2 + 2;
+		arena_reallocate(&u->arena, u->bonds, u->bonds_capacity, capacity, MEMORY_BONDS);
+		u->bonds_capacity = capacity;
+	}
+	Bond *bond = &u->bonds[u->n_bonds++];
+	memset(bond, 0, sizeof *bond);
+	bond->a = id_a; bond->b = id_b;
+	bond->number = bond_number;
+	if (already_connected) return energy; // remaining code is only for new additions to molecules
+
+	bool a_in_molecule = mol_a != -1;
+	bool b_in_molecule = mol_b != -1;
+	MoleculeID result_mol = -1;
+	float a_mass = 0, b_mass = 0;
+	vec2 a_vel = Vec2(atoms->vx[id_a], atoms->vy[id_a]);
+	vec2 b_vel = Vec2(atoms->vx[id_b], atoms->vy[id_b]);
+
+	a_mass = a_in_molecule ? u->molecules[mol_a].mass : atom_mass(atoms->valence[id_a]);
+	b_mass = b_in_molecule ? u->molecules[mol_b].mass : atom_mass(atoms->valence[id_b]);
+	assert(a_mass > 1 && b_mass > 1);
+
+	if (a_in_molecule && b_in_molecule) {
+		// join molecules
+		result_mol = molecules_join(u, mol_a, mol_b);
+	} else if (a_in_molecule && !b_in_molecule) {
+		// add b to a's molecule
+		add_to_molecule(u, mol_a, id_b);
+		result_mol = mol_a;
+	} else if (!a_in_molecule && b_in_molecule) {
+		// add a to b's molecule
+		add_to_molecule(u, mol_b, id_a);
+		result_mol = mol_b;
+	} else {
+		// make a new molecule with a and b
+		result_mol = molecule_new(u);
+		add_to_molecule(u, result_mol, id_a);
+		add_to_molecule(u, result_mol, id_b);
+	}
+
+	// conservation of momentum:
+	// a_mass * a_vel + b_mass * b_vel = (a_mass + b_mass) * result_vel
+	// result_vel = (a_mass * a_vel + b_mass * b_vel) / (a_mass + b_mass)
+
+	vec2 result_vel = scale(add(scale(a_vel, a_mass), scale(b_vel, b_mass)), 1.0f / (a_mass + b_mass));
+	for (AtomID id = u->molecules[result_mol].first_atom; id != NO_ATOM; id = atoms->next_in_molecule[id]) {
+		atoms->vx[id] = result_vel.x;
+		atoms->vy[id] = result_vel.y;
+	}
+
+	assert(atom_molecule(u, id_a) == result_mol);
+	assert(atom_molecule(u, id_b) == result_mol);
+	assert(atoms->vx[id_a] == atoms->vx[id_b] && atoms->vy[id_a] == atoms->vy[id_b]);
+	return energy;
+}
+
+
+// floats before the top halo row, so rows are cache line aligned and the halo
+// cell before the top halo row exists
+#define HEATMAP_PAD (CACHE_LINE_SIZE / (int)sizeof(float))
+
+static size_t heatmap_size(int height, int stride) {
+	return HEATMAP_PAD + (size_t)stride * (size_t)(height + 2);
+}
+
+// allocate a heat grid including its halo. it isn't zeroed; every cell is written
+// before it's read.
+static float *heatmap_new(Universe *u) {
+	float *grid = arena_allocate(&u->arena, float, heatmap_size(u->height, u->heatmap_stride), 0, MEMORY_HEATMAP);
+	return grid + HEATMAP_PAD + u->heatmap_stride;
+}
+
+// rows per task for work that is split into horizontal bands
+#define BAND_ROWS 16
+
+static unsigned universe_n_bands(Universe const *u) {
+	return (unsigned)(u->height + BAND_ROWS - 1) / BAND_ROWS;
+}
+
+static void diffuse_band(void *userdata, unsigned band) {
+	Universe *u = userdata;
+	int y0 = (int)band * BAND_ROWS;
+	int y1 = min(y0 + BAND_ROWS, u->height);
+	diffuse_rows(u->heatmap_back, u->heatmap, u->width, u->height, u->heatmap_stride, y0, y1, 0.03f);
+}
+
+typedef struct {
+	Universe *u;
+	float p_bond; // chance of trying to form a bond in a cell with at least 2 atoms
+} BondJob;
+
+// pick a random pair of atoms in each cell of this band, and check if they can bond.
+// this only reads the cell's own atoms and heat, which nothing else changes until the
+// proposals are committed, and each cell draws from its own random stream (keyed by
+// seed, step and cell), so bands can run in any order.
+static void bond_propose_band(void *userdata, unsigned band) {
+	BondJob const *job = userdata;
+	Universe *u = job->u;
+	Atoms const *atoms = &u->atoms;
+	int y0 = (int)band * BAND_ROWS;
+	int y1 = min(y0 + BAND_ROWS, u->height);
+	// each cell proposes at most one bond, so the band's proposals fit in its cells' slots
+	BondProposal *proposals = &u->bond_proposals[y0 * u->width];
+	unsigned n_proposals = 0;
+
+	for (int y = y0; y < y1; ++y) {
+		for (int x = 0; x < u->width; ++x) {
+			int i = y * u->width + x;
+			AtomID const *cell_atoms = &u->cell_atoms[u->cell_start[i]];
+			int n_cell_atoms = (int)(u->cell_start[i + 1] - u->cell_start[i]);
+			int heat_index = y * u->heatmap_stride + x;
+			if (n_cell_atoms < 2) continue;
+
+			Rng rng = rng_stream(u->seed, u->step, (uint32_t)i);
+			if (rng_float(&rng) >= job->p_bond)
+				continue;
+
+			// r2 is uniform over the other atoms
+			int r1 = (int)rng_below(&rng, (uint32_t)n_cell_atoms);
+			int r2 = (r1 + 1 + (int)rng_below(&rng, (uint32_t)n_cell_atoms - 1)) % n_cell_atoms;
+
+			AtomID id_a = cell_atoms[r1];
+			AtomID id_b = cell_atoms[r2];
+			vec2 a_pos = Vec2(atoms->x[id_a], atoms->y[id_a]);
+			vec2 b_pos = Vec2(atoms->x[id_b], atoms->y[id_b]);
+			if (sqdistance(a_pos, b_pos) < 0.1f) continue; // bond would be too short
+			if (atoms->valence[id_a] <= atoms->n_bonds[id_a] || atoms->valence[id_b] <= atoms->n_bonds[id_b]) continue;
+			if (bond_energy(atoms->valence[id_a], atoms->valence[id_b], 0) > u->heatmap[heat_index])
+				continue; // no way can we form this bond!
+			assert(cell_for_atom(u, id_a) == (unsigned)i);
+			assert(cell_for_atom(u, id_b) == (unsigned)i);
+			BondProposal *p = &proposals[n_proposals++];
+			p->a = id_a;
+			p->b = id_b;
+			p->heat_index = heat_index;
+		}
+	}
+	u->band_n_proposals[band] = n_proposals;
+}
+
+// streams of random numbers used to set up a universe. they use a step number
+// that is never stepped, so they're independent of the ones used for bonding.
+#define RNG_SETUP_STEP UINT64_MAX
+enum {
+	RNG_SETUP_HEAT,
+	RNG_SETUP_X,
+	RNG_SETUP_Y,
+	RNG_SETUP_DIRECTION,
+	RNG_SETUP_VALENCE,
+};
+
+static Rng setup_rng(Universe const *u, uint32_t stream) {
+	return rng_stream(u->seed, RNG_SETUP_STEP, stream);
+}
+
+// about how much universe_init allocates, so it can all go in one chunk.
+// (if it's an underestimate, the rest just goes in another chunk)
+static size_t universe_arena_size(Universe const *u) {
+	size_t area = (size_t)u->width * (size_t)u->height;
+	size_t per_atom = 4 * sizeof(float) + 2 * sizeof(unsigned char) + sizeof(MoleculeID) + sizeof(BondedAtoms)
+		+ 2 * sizeof(AtomID) + sizeof(unsigned);
+	size_t bytes = 2 * heatmap_size(u->height, u->heatmap_stride) * sizeof(float)
+		+ u->n_atoms * per_atom
+		+ (area + 1) * sizeof(unsigned) + area * sizeof(BondProposal)
+		+ universe_n_bands(u) * sizeof(unsigned);
+	// each allocation is rounded up to a cache line
+	return bytes + 16 * CACHE_LINE_SIZE;
+}
+
+// fill in a new universe. u must be zeroed apart from its (empty) arena and its pool.
+static void universe_init(Universe *u, UniverseSettings const *settings) {
+	u->width = settings->width;
+	u->height = settings->height;
+	u->n_atoms = settings->n_atoms;
+	u->average_heat_per_cell = settings->average_heat_per_cell;
+	u->seed = settings->seed;
+	size_t universe_area = (size_t)u->width * (size_t)u->height;
+	u->heatmap_stride = diffuse_stride(u->width);
+	arena_reserve(&u->arena, universe_arena_size(u));
+	u->heatmap = heatmap_new(u);
+	u->heatmap_back = heatmap_new(u);
+
+	float average_heat_per_cell = settings->average_heat_per_cell;
+	if (settings->random_heat) {
+		// the back buffer isn't used yet, and has room for all the cells without padding
+		Rng rng = setup_rng(u, RNG_SETUP_HEAT);
+		rng_fill_floats(&rng, u->heatmap_back, universe_area);
+		for (int y = 0; y < u->height; ++y) {
+			float *row = &u->heatmap[y * u->heatmap_stride];
+			float const *random = &u->heatmap_back[y * u->width];
+			for (int x = 0; x < u->width; ++x)
+				row[x] = random[x] * average_heat_per_cell * 2.0f;
+		}
+	} else {
+		for (int y = 0; y < u->height; ++y) {
+			float *row = &u->heatmap[y * u->heatmap_stride];
+			for (int x = 0; x < u->width; ++x)
+				row[x] = average_heat_per_cell;
+		}
+	}
+
+	u->heat_dirty_y0 = 0;
+	u->heat_dirty_y1 = u->height;
+
+	Atoms *atoms = &u->atoms;
+	// only the arrays which are read before they're written need zeroing: the rest are
+	// filled in below or by grid_rebuild
+	Arena *arena = &u->arena;
+	atoms->x = arena_allocate(arena, float, u->n_atoms, 0, MEMORY_ATOMS);
+	atoms->y = arena_allocate(arena, float, u->n_atoms, 0, MEMORY_ATOMS);
+	atoms->vx = arena_allocate(arena, float, u->n_atoms, 0, MEMORY_ATOMS);
+	atoms->vy = arena_allocate(arena, float, u->n_atoms, 0, MEMORY_ATOMS);
+	atoms->valence = arena_allocate(arena, unsigned char, u->n_atoms, 0, MEMORY_ATOMS);
+	atoms->n_bonds = arena_allocate(arena, unsigned char, u->n_atoms, MEMORY_ZERO, MEMORY_ATOMS);
+	atoms->molecule = arena_allocate(arena, MoleculeID, u->n_atoms, 0, MEMORY_ATOMS);
+	atoms->bonded = arena_allocate(arena, BondedAtoms, u->n_atoms, MEMORY_ZERO, MEMORY_ATOMS);
+	atoms->next_in_molecule = arena_allocate(arena, AtomID, u->n_atoms, 0, MEMORY_ATOMS);
+	u->cell_start = arena_allocate(arena, unsigned, universe_area + 1, 0, MEMORY_GRID);
+	u->cell_atoms = arena_allocate(arena, AtomID, u->n_atoms, 0, MEMORY_GRID);
+	u->atom_cell = arena_allocate(arena, unsigned, u->n_atoms, 0, MEMORY_GRID);
+	u->bond_proposals = arena_allocate(arena, BondProposal, universe_area, 0, MEMORY_BONDS);
+	u->band_n_proposals = arena_allocate(arena, unsigned, universe_n_bands(u), 0, MEMORY_BONDS);
+
+	// generate each property in a batch, straight into the arrays (directions into vx,
+	// valences into atom_cell, which grid_rebuild overwrites), then scale them
+	Rng rng = setup_rng(u, RNG_SETUP_X);
+	rng_fill_floats(&rng, atoms->x, u->n_atoms);
+	rng = setup_rng(u, RNG_SETUP_Y);
+	rng_fill_floats(&rng, atoms->y, u->n_atoms);
+	rng = setup_rng(u, RNG_SETUP_DIRECTION);
+	rng_fill_floats(&rng, atoms->vx, u->n_atoms);
+	rng = setup_rng(u, RNG_SETUP_VALENCE);
+	rng_fill_u32(&rng, u->atom_cell, u->n_atoms);
+	for (AtomID i = 0; i < u->n_atoms; ++i) {
+		atoms->molecule[i] = -1;
+		atoms->x[i] *= (float)u->width;
+		atoms->y[i] *= (float)u->height;
+		vec2 vel = vec2_polar(5, atoms->vx[i] * 6.28f);
+		atoms->vx[i] = vel.x;
+		atoms->vy[i] = vel.y;
+		atoms->valence[i] = (unsigned char)(rng_to_below(u->atom_cell[i], 4) + 1);
+	}
+	u->positions_dirty = true;
+	grid_rebuild(u);
+}
+
+Universe *universe_create(UniverseSettings const *settings) {
+	Universe *u = memory_allocate(Universe, 1, MEMORY_OTHER);
+	arena_init(&u->arena);
+	u->pool = pool_create(settings->n_threads ? settings->n_threads : os_n_cpus());
+	universe_init(u, settings);
+	return u;
+}
+
+void universe_reset(Universe *u, UniverseSettings const *settings) {
+	// keep the arena's chunks and the threads, and start everything else over.
+	// diffuse is dropped too: whatever it keeps (e.g. GPU textures) holds the old heat,
+	// at the old size
+	Arena arena = u->arena;
+	ThreadPool *pool = u->pool;
+	unsigned generation = u->generation + 1;
+	unsigned n_threads = settings->n_threads ? settings->n_threads : os_n_cpus();
+	if (pool_n_threads(pool) != n_threads) {
+		pool_destroy(pool);
+		pool = pool_create(n_threads);
+	}
+	arena_reset(&arena);
+	memset(u, 0, sizeof *u);
+	u->arena = arena;
+	u->pool = pool;
+	u->generation = generation;
+	universe_init(u, settings);
+}
+
+static void heat_mark_dirty(Universe *u, int y0, int y1) {
+	u->heat_dirty_y0 = min(u->heat_dirty_y0, y0);
+	u->heat_dirty_y1 = max(u->heat_dirty_y1, y1);
+}
+
+static void heat_change_add(Universe *u, unsigned cell, float heat) {
+	if (u->n_heat_changes >= u->heat_changes_capacity) {
+		unsigned capacity = u->heat_changes_capacity * 2 + 16;
+		arena_reallocate(&u->arena, u->heat_changes, u->heat_changes_capacity, capacity, MEMORY_HEATMAP);
+		u->heat_changes_capacity = capacity;
+	}
+	HeatChange *change = &u->heat_changes[u->n_heat_changes++];
+	change->cell = cell;
+	change->heat = heat;
+}
+
+void universe_diffuse(Universe *u) {
+	if (u->diffuse) {
+		u->diffuse(u, u->diffuse_userdata);
+	} else {
+		pool_run(u->pool, diffuse_band, u, universe_n_bands(u));
+		float *tmp = u->heatmap;
+		u->heatmap = u->heatmap_back;
+		u->heatmap_back = tmp;
+		heat_mark_dirty(u, 0, u->height);
+	}
+}
+
+void universe_move(Universe *u, float dt) {
+	integrate_positions(u->atoms.x, u->atoms.vx, u->n_atoms, dt, (float)u->width);
+	integrate_positions(u->atoms.y, u->atoms.vy, u->n_atoms, dt, (float)u->height);
+	u->positions_dirty = true;
+}
+
+void universe_regrid(Universe *u) {
+	grid_rebuild(u);
+}
+
+void universe_bond(Universe *u, float dt) {
+	// bands propose at most one bond per cell in parallel, then the proposals are committed in cell order
+	BondJob job = {u, powf(0.9f, 1.0f / dt)};
+	unsigned n_bands = universe_n_bands(u);
+	pool_run(u->pool, bond_propose_band, &job, n_bands);
+	for (unsigned band = 0; band < n_bands; ++band) {
+		BondProposal const *proposals = &u->bond_proposals[band * BAND_ROWS * (unsigned)u->width];
+		for (unsigned i = 0; i < u->band_n_proposals[band]; ++i) {
+			BondProposal const *p = &proposals[i];
+			float energy = make_bond(u, p->a, p->b);
+			int x = p->heat_index % u->heatmap_stride, y = p->heat_index / u->heatmap_stride;
+			u->heatmap[p->heat_index] -= energy;
+			heat_mark_dirty(u, y, y + 1);
+			if (u->diffuse && energy != 0)
+				heat_change_add(u, (unsigned)(y * u->width + x), -energy);
+		}
+	}
+}
+
+void universe_step(Universe *u, float dt) {
+	profile_zone(PROFILE_DIFFUSE) {
+		universe_diffuse(u);
+	}
+	profile_zone(PROFILE_MOVE) {
+		universe_move(u, dt);
+		universe_regrid(u);
+	}
+	profile_zone(PROFILE_BOND) {
+		universe_bond(u, dt);
+	}
+	++u->step;
+}
+
+unsigned universe_advance(Universe *u, Stepper *stepper, double real_dt) {
+	assert(stepper->step_size > 0);
+	stepper->accumulator += real_dt * stepper->speed;
+	unsigned n_steps = 0;
+	while (stepper->accumulator >= stepper->step_size) {
+		if (n_steps >= stepper->max_steps) {
+			// we can't keep up; slow down instead of trying to catch up forever
+			stepper->accumulator = 0;
+			break;
+		}
+		universe_step(u, stepper->step_size);
+		stepper->accumulator -= stepper->step_size;
+		++n_steps;
+	}
+	return n_steps;
+}
+
+void universe_destroy(Universe *u) {
+	pool_destroy(u->pool);
+	// everything else is in the arena
+	arena_free(&u->arena);
+	memory_free(u);
+}
@@ -0,0 +1,143 @@
+#ifndef UNIVERSE_H_
+#define UNIVERSE_H_
+
+#include <stdbool.h>
+#include "arena.h"
+#include "core.h"
+#include "mmath.h"
+#include "pool.h"
+
+typedef unsigned AtomID;
+typedef int MoleculeID;
+
+// marks the end of a molecule's list of atoms
+#define NO_ATOM ((AtomID)-1)
+
+// valence is at most 4, so an atom is bonded to at most 4 other atoms
+#define MAX_BONDED_ATOMS 4
+
+// which atoms an atom is bonded to, and with how many bonds (e.g. 2 for a double bond)
+typedef struct {
+	AtomID atom[MAX_BONDED_ATOMS];
+	unsigned char order[MAX_BONDED_ATOMS]; // 0 = unused slot
+} BondedAtoms;
+
+// atoms are stored as a structure of arrays, each indexed by AtomID
+typedef struct {
+	float *x, *y; // position
+	float *vx, *vy; // velocity
+	unsigned char *valence;
+	unsigned char *n_bonds; // current # of bonds
+	MoleculeID *molecule; // -1 = no molecule. may be a molecule which has since been merged into another.
+	AtomID *next_in_molecule; // links each molecule's atoms into a list
+	BondedAtoms *bonded;
+} Atoms;
+
+typedef struct {
+	AtomID a, b;
+	unsigned char number; // a double bond is represented with Bond(a, b, 0) and Bond(a, b, 1), for example
+} Bond;
+
+// molecules are tracked with union-find: when two molecules join, the smaller one
+// points to the larger one with parent, and its atoms are spliced onto the larger's list.
+typedef struct {
+	MoleculeID parent; // the molecule this was merged into, or itself if it wasn't
+	// the rest is only meaningful if parent is itself
+	float mass;
+	unsigned n_atoms;
+	AtomID first_atom, last_atom;
+} Molecule;
+
+// a bond which bonding has checked can form, waiting to be made
+typedef struct {
+	AtomID a, b;
+	int heat_index; // index into heatmap of the cell a and b are in
+} BondProposal;
+
+// heat added to (or, when bonds form, taken out of) a cell
+typedef struct {
+	unsigned cell; // y * width + x
+	float heat;
+} HeatChange;
+
+typedef struct {
+	int width, height;
+	AtomID n_atoms;
+	unsigned long long seed; // seeds all the random numbers (see rng.h)
+	float average_heat_per_cell;
+	bool random_heat; // if false, every cell starts at average_heat_per_cell
+	unsigned n_threads; // threads to step with, including the caller. 0 = one per CPU
+} UniverseSettings;
+
+typedef struct Universe {
+	// everything the universe allocates (apart from itself and its pool) comes from here
+	Arena arena;
+	// incremented by universe_reset, so whoever copies bonds (which are otherwise only
+	// ever added to) knows to start again
+	unsigned generation;
+	int width, height;
+	AtomID n_atoms;
+	Atoms atoms;
+	// the atoms in cell i are cell_atoms[cell_start[i]] ... cell_atoms[cell_start[i+1]-1],
+	// rebuilt after every step with a counting sort
+	unsigned *cell_start; // width * height + 1 entries
+	AtomID *cell_atoms;
+	unsigned *atom_cell; // the cell each atom is in
+	BondProposal *bond_proposals; // one slot per cell, filled in by bonding
+	unsigned *band_n_proposals; // # of proposals each band of rows made this step
+	// heat in each cell: cell (x, y) is heatmap[y * heatmap_stride + x].
+	// rows are surrounded by a one-cell halo (see diffuse.h)
+	float *heatmap;
+	float *heatmap_back; // heat is dispersed from heatmap into this, then they're swapped
+	int heatmap_stride;
+	// rows heat_dirty_y0 <= y < heat_dirty_y1 of heatmap have changed since whoever
+	// is copying the heat (e.g. to a texture) last reset these to (height, 0)
+	int heat_dirty_y0, heat_dirty_y1;
+	// set whenever atoms move, for whoever is copying their positions to clear
+	bool positions_dirty;
+	float average_heat_per_cell;
+	// if set, this is called at the start of each step instead of dispersing heat on the CPU
+	// (e.g. to do it on the GPU). heatmap is then only a copy, which bonding reads and
+	// updates, and every change bonding makes to it is also added to heat_changes, for
+	// diffuse to apply to the real heat and clear.
+	void (*diffuse)(struct Universe *u, void *userdata);
+	void *diffuse_userdata;
+	HeatChange *heat_changes;
+	unsigned n_heat_changes, heat_changes_capacity;
+	Bond *bonds;
+	unsigned n_bonds, bonds_capacity;
+	Molecule *molecules;
+	MoleculeID n_molecules, molecules_capacity;
+	ThreadPool *pool;
+	unsigned long long seed;
+	unsigned long long step; // # of steps taken so far
+} Universe;
+
+// turns wall-clock time into a whole number of fixed-size steps, so that
+// results don't depend on the frame rate
+typedef struct {
+	float step_size; // simulated seconds per step
+	float speed; // simulated seconds per real second
+	unsigned max_steps; // most steps to run per call to universe_advance; any backlog beyond this is dropped
+	double accumulator; // simulated time not yet stepped
+} Stepper;
+
+// make a new universe with randomly placed atoms
+extern Universe *universe_create(UniverseSettings const *settings);
+// start u over as if it had just been made with these settings, reusing its memory
+// and threads. u->diffuse is cleared, so whoever set it must set it up again for the
+// new universe (e.g. heat_gpu_destroy, then heat_gpu_init).
+extern void universe_reset(Universe *u, UniverseSettings const *settings);
+// advance the simulation by dt seconds (disperse heat, move atoms, form bonds)
+extern void universe_step(Universe *u, float dt);
+// the phases of universe_step, which runs them in this order and then increments step.
+// exposed so they can be benchmarked separately.
+extern void universe_diffuse(Universe *u);
+extern void universe_move(Universe *u, float dt); // atoms' positions only
+extern void universe_regrid(Universe *u); // re-sort atoms into cells after moving them
+extern void universe_bond(Universe *u, float dt);
+// run as many steps as fit into real_dt seconds of wall-clock time. returns the number of steps run.
+extern unsigned universe_advance(Universe *u, Stepper *stepper, double real_dt);
+extern void universe_destroy(Universe *u);
+
+#endif // UNIVERSE_H_